@@ -42,10 +42,33 @@
 #include <linux/poll.h>
 #include <asm/uaccess.h>
 #include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/spi/spi.h>
+#include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kfifo.h>
+#include <linux/crc-ccitt.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/cacheflush.h>
+#include <linux/platform_device.h>
+#include <linux/of.h>
+#include <linux/of_gpio.h>
+#include <linux/idr.h>
+#include <linux/random.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/platform_data/a7139.h>
 
 #include "a7139_rf.h"
 #include "a7139.h"
 
+#define CREATE_TRACE_POINTS
+#include "a7139_trace.h"
+
 /* Defines by hardware pin */
 #define GPIO_TO_PIN(b, g)       (32 * (b) + (g))
 #define GPIO_SDIO               GPIO_TO_PIN(3, 17)
@@ -67,10 +90,80 @@
 #define spi_mdelay(n)           mdelay(n)
 #define spi_defdelay()          spi_ndelay(80)
 
+/* AM335x GPIO bank registers, for the direct mmio bit-bang fast path */
+#define AM335X_GPIO_BANK_SIZE   0x1000
+#define AM335X_GPIO_DATAIN      0x138
+#define AM335X_GPIO_CLEARDATAOUT 0x190
+#define AM335X_GPIO_SETDATAOUT  0x194
+#define A7139_SCK_MAX_HZ        10000000   /* chip max SCK rate */
+#define A7139_BENCH_REG_LOOPS   256
+#define A7139_BENCH_FIFO_LOOPS  64
+
+/* McSPI backend, SCS/SCK/SDIO must be muxed to the McSPI instance by the board */
+#define A7139_SPI_DEF_SPEED     4000000    /* Hz, chip allows up to 10MHz SCK */
+#define A7139_XFER_BUFSIZE      (RF_BUFSIZE + 1)
+
 #define DEV_WRITE_TIMEOUT       1000       /* ms */
 #define DEVICE_NAME             "a7139"    /* device name, see it on /proc/devices */
-#define A7139_MAJOR             271        /* master device id */
+#define A7139_MINORS            32         /* radios, /dev/a7139-1 .. */
 #define RF_BUFSIZE              64
+#define RF_RX_FRAMES            16         /* default rx queue depth per file, in frames */
+#define RF_TX_FRAMES            16         /* default tx queue depth, in frames */
+#define RF_RX_FRAMES_MAX        1024
+#define RF_TX_FRAMES_MAX        256
+
+/*
+ * FIFO extension, frames longer than the FIFO stream through it in
+ * RF_BUFSIZE segments on FPF. On air: length, payload, crc-ccitt, padding.
+ */
+#define A7139_EXT_HLEN          2          /* little endian payload length */
+#define A7139_EXT_CRCLEN        2
+#define A7139_EXT_MIN_TAIL      7          /* last segment length, 5 < FEP < 63 */
+#define A7139_PIN_INFS          0x0200     /* PIN_REG: infinite length */
+#define A7139_CODE_CRCS         0x0008     /* CODE_PAGEA: hardware crc */
+#define A7139_CODE_FECS         0x0010     /* CODE_PAGEA: FEC */
+#define A7139_GIO_FPF           0x0075     /* GIO_PAGEA: GIO1=FPF, GIO2=WTR */
+
+/* hardware Auto-ACK/Auto-Resend */
+#define A7139_GIO_VPOAK         0x0071     /* GIO_PAGEA: GIO1=VPOAK, GIO2=WTR */
+#define A7139_ACK_EAK           0x0001     /* ACK_PAGEB: enable auto ack */
+#define A7139_ACK_EAR           0x0002     /* ACK_PAGEB: enable auto resend */
+#define A7139_ACK_ARC_SHIFT     2          /* ACK_PAGEB: ARC[3:0], resend count */
+#define RF_TX_RESULTS           16         /* auto resend results kept until read */
+
+/* Wake-on-Radio */
+#define A7139_MODE_WORE         0x0200     /* MODE_REG write: WOR enable, read back it is CRCF */
+#define A7139_RCOSC_CAL_TRIES   16
+
+/*
+ * VCO calibration results and their manual override, the manual select
+ * bit sits where the fail flag reads back
+ */
+#define A7139_CALREG_VB(x)      (((x) >> 5) & 0x07)    /* CALIBRATION_REG: VB[2:0] */
+#define A7139_CALREG_MVBS       0x0100                 /* CALIBRATION_REG: manual VCO band */
+#define A7139_CALREG_MVB_MASK   0x00E0
+#define A7139_VCB_VCB(x)        ((x) & 0x0F)           /* VCB_PAGEA: VCB[3:0] */
+#define A7139_VCB_MVCS          0x0010                 /* VCB_PAGEA: manual VCO current */
+#define A7139_CRYSTAL_PAGEA     0xF000                 /* CRYSTAL_REG: PAGEA[3:0] select */
+#define A7139_CRYSTAL_PAGEB     0x0380                 /* CRYSTAL_REG: PAGEB[2:0] select */
+#define A7139_VCB_VCOC_MASK     0x000F
+
+/* fractional-N synthesizer, f = (IP + FP / 2^16) * 12.8MHz */
+#define A7139_XTAL_HZ           12800000
+#define A7139_PLL1_IP_MASK      0x00FF     /* PLL1_REG: IP[7:0] */
+#define A7139_CH_CAL_SLOTS      A7139_PLAN_MAX_CHANNELS    /* >= RF_FREQ_TAB_MAXSIZE */
+
+/* RSSI settles within RS_DLY after the RX strobe */
+#define A7139_RSSI_SETTLE_US    1000
+#define A7139_SURVEY_SAMPLE_US  200
+
+/* latency histograms, log2 microsecond buckets, the last one open ended */
+#define A7139_HIST_BUCKETS      16
+
+/* calibration status polling */
+#define A7139_CAL_TIMEOUT_US    20000      /* per stage, datasheet stages take < 2ms */
+#define A7139_CAL_POLL_MIN_US   50
+#define A7139_CAL_POLL_MAX_US   100
 
 #define VERSION                 "1.1.0"
 #define DEBUG
@@ -89,39 +182,191 @@ struct rf_spi_pin {
     int gio1;
 };
 
+struct rf_dev;
+
+/* register files mirrored in rf_dev.shadow */
+enum {
+    A7139_SHADOW_MAIN,
+    A7139_SHADOW_PAGE_A,
+    A7139_SHADOW_PAGE_B,
+    A7139_SHADOW_FILES,
+};
+
+/*
+ * 3-wire bus backend, every chip access is one SCS frame:
+ * a command byte followed by len data bytes written or read
+ */
+struct rf_bus_ops {
+    const char *name;
+    void (*write)(struct rf_dev *dev, uint8_t cmd, const uint8_t *buf, int len);
+    void (*read)(struct rf_dev *dev, uint8_t cmd, uint8_t *buf, int len);
+};
+
+/* per radio counters, debugfs <name>/stats, cleared by writing it */
+struct rf_stats {
+    uint32_t irqs;
+    uint32_t irqs_stale;            /* edges from before the last mode switch */
+    uint32_t rx_frames;
+    uint32_t rx_crc_err;
+    uint32_t rx_dropped;            /* per reader, its rx queue or the ring full */
+    uint32_t rx_filtered;           /* per reader, no rule of its filter matched */
+    uint32_t tx_frames;
+    uint32_t tx_timeouts;           /* write() gave up on a full tx queue */
+    uint32_t mode_switches;
+    uint32_t cal_failures;
+    uint32_t lbt_deferrals;
+    uint32_t lbt_abandoned;
+    uint32_t irq_to_read[A7139_HIST_BUCKETS];
+    uint32_t write_to_txdone[A7139_HIST_BUCKETS];
+};
+
 struct rf_dev {
     /* struct for kernel platform */
     struct cdev cdev;
     struct class *dev_class;
     char *name_alias;
+    char name[16];
+    int index;                      /* minor, /dev/a7139-<index+1> */
     int irq;
+    int irq_line;                   /* GIO1 interrupt, requested on open */
 
     /* hardware chip pin configs */
     struct rf_spi_pin pin;
 
+    /* chip bus access, gpio bit-bang or McSPI */
+    int spi_bus;
+    int spi_cs;
+    int spi_speed;
+    const struct rf_bus_ops *bus;
+    struct spi_device *spi;
+    struct mutex bus_lock;
+    uint8_t *xfer_buf;
+    void __iomem *gpio_base;        /* mapped bank of SCS/SCK/SDIO, mmio path */
+    uint32_t scs_mask;
+    uint32_t sck_mask;
+    uint32_t sdio_mask;
+    unsigned int half_ns;           /* calibrated SCK half period padding */
+    struct dentry *debugfs;
+
     /* 433 modules configs */
     volatile A7139_MODE rf_currmode;
     A7139_RATE rf_datarate;
     uint8_t rf_freq_ch;
+    A7139_CH_CFG ch_cfg;
     uint8_t rf_id[RF_IDSIZE];
+    uint16_t rf_tx2;                /* TX2_PAGEB, tx power */
+    uint16_t rf_code;               /* CODE_PAGEA, FEC and crc */
     //uint32_t rf_dst_addr;
     //uint32_t rf_src_addr;
 
     /* variables */
-    uint8_t txbuf[RF_BUFSIZE];
-    uint8_t rxbuf[RF_BUFSIZE];
-    uint8_t rx_len;
-    uint8_t tx_len;
+    uint8_t txbuf[A7139_EXT_HLEN + A7139_FRAME_MAX + A7139_EXT_CRCLEN + RF_BUFSIZE];
+    uint8_t rxbuf[sizeof(A7139_RX_HDR) + A7139_FRAME_MAX + A7139_EXT_CRCLEN + RF_BUFSIZE];  /* FIFO drain scratch */
+    unsigned int tx_len;
+
+    /* FIFO extension progress, in bytes on air */
+    unsigned int frame_max;         /* longest payload, > RF_BUFSIZE uses the extension */
+    unsigned int rx_pos;
+    unsigned int rx_air;
+    unsigned int rx_len;
+    unsigned int tx_pos;
+    unsigned int tx_air;
+
+    /* open files, each with its own queue of the received frames */
+    struct list_head files;
+    struct rf_file *owner;          /* may change the radio config */
+    unsigned int hdr_readers;       /* files reading A7139_RXFMT_HDR */
+    A7139_RX_HDR rx_meta;           /* captured by the rx done irq */
+
+    /* frames waiting to be sent, drained back-to-back by tx_work */
+    struct kfifo_rec_ptr_2 tx_fifo;
+    struct kfifo tx_stamps;         /* write() time in ns of each tx_fifo frame */
+    s64 tx_stamp;                   /* of the frame on air, 0 for ring frames */
+
+    struct rf_stats stats;
+
+    /* hardware ack, one VPOAK result per frame sent with auto resend */
+    A7139_ACK_CFG ack_cfg;
+    uint32_t tx_seq;
+    uint32_t tx_acked;
+    uint32_t tx_noack;
+    DECLARE_KFIFO(tx_res, A7139_TX_RES, RF_TX_RESULTS);
+
+    /* duty-cycled rx, armed while in A7139_MODE_RX */
+    A7139_WOR_CFG wor_cfg;
+    int wor_armed;
+    uint32_t wor_wakes;
+    uint32_t wor_false_wakes;
+
+    /* listen before talk, a busy channel holds the frame in txbuf */
+    A7139_LBT_CFG lbt_cfg;
+    int lbt_held;
+    unsigned int lbt_tries;
+    unsigned long lbt_until;        /* jiffies, end of the backoff */
+    uint8_t lbt_rssi;
+    ktime_t rx_since;               /* last RX strobe */
+    struct delayed_work lbt_work;
+
+    A7139_CAL_STAT cal_stat;
+
+    /* VCO band and current per table or plan channel, calibrated on first use */
+    struct {
+        uint8_t valid;
+        uint8_t vb;
+        uint8_t vcb;
+    } ch_cal[A7139_CH_CAL_SLOTS];
+
+    /* write-through copy of the register files, lost on RF_RST */
+    uint16_t shadow[A7139_SHADOW_FILES][16];
+    uint16_t shadow_valid[A7139_SHADOW_FILES];
+    int id_valid;
+    uint32_t reg_saved;             /* bus frames the shadow made unnecessary */
+
+    /* mmap() rx/tx slot rings of the owner, replace its rx queue while set up */
+    void *ring;
+    size_t ring_size;
+    A7139_RING_REQ ring_req;
+    unsigned int ring_rx_head;      /* next rx slot to fill */
+    unsigned int ring_tx_tail;      /* next tx slot to send */
+    atomic_t ring_mapped;
 
     struct semaphore sem;
     struct workqueue_struct *work_queue;
-    struct work_struct work;
-    volatile uint32_t rf_txevt;
-    volatile uint32_t rf_rxevt;
+    struct work_struct tx_work;
+    struct mutex open_lock;         /* first open and last release */
     uint32_t opencount;
+    struct kref ref;                /* held by probe and by every open file */
+    int gone;                       /* removed, open files only get -ENODEV */
     wait_queue_head_t r_wait;
     wait_queue_head_t w_wait;
 	struct tasklet_struct tasklet;
+
+    /* threaded irq, edges older than the last mode switch are ignored */
+    struct task_struct *irq_task;
+    spinlock_t irq_lock;            /* the hard irq stamp and counters */
+    ktime_t irq_stamp;
+    s64 rx_stamp;                   /* irq time of the frame in rx_done */
+    unsigned int irq_gen;
+    int irq_pending;                /* stamped, not yet taken by the thread */
+    unsigned int mode_gen;
+};
+
+/* a received frame, shared by the queues of all files */
+struct rf_frame {
+    struct kref ref;
+    s64 stamp;                      /* irq time in ns */
+    A7139_RX_HDR hdr;
+    uint8_t data[0];                /* follows hdr, A7139_RXFMT_HDR reads both */
+};
+
+/* per open file */
+struct rf_file {
+    struct rf_dev *dev;
+    struct list_head node;          /* on dev->files */
+    fmode_t mode;
+    A7139_RXFMT rx_fmt;
+    A7139_FILTER filter;
+    DECLARE_KFIFO_PTR(rxq, struct rf_frame *);
 };
 
 const uint16_t rf_reg_cfg[] =   //470MHz, 10kbps (IFBW = 50KHz, Fdev = 18.75KHz)
@@ -212,35 +457,49 @@ uint16_t freq_cal_tab[RF_FREQ_TAB_MAXSIZE*2] = {
     0x0A27, 0x1005,     // 15, 500.001MHz
 };
 
+static const unsigned long am335x_gpio_bank_base[] = {
+    0x44E07000,         // GPIO0
+    0x4804C000,         // GPIO1
+    0x481AC000,         // GPIO2
+    0x481AE000,         // GPIO3
+};
+
 /*
  * ʼ㷽(ϸɲμA7139оƬֲᡷ12ҳ):
  * DMOS(0AhĴ)Ϊ1ʱ, DataRate = (1/64)*Fcsck/(SDR[6:0]+1); (, ĬDMOS=1)
  * DMOS(0AhĴ)Ϊ0ʱ, DataRate = (1/32)*Fcsck/(SDR[6:0]+1);
  * Fcsck = Fmsck/(CSC[2:0]+1), FmsckA7139оƬ12.8MHZ, SDR[6:0]CSC[2:0]00hĴ
+ *
+ * Registers that follow the data rate, the rest of the config, AGC
+ * included, is shared.
+ * IFBW keeps the Carson bandwidth 2 * (Fdev + rate / 2) inside the filter,
+ * RX1 BW[1:0] 0x1850: 50KHz, 0x1854: 100KHz, 0x1858: 150KHz. TX1 Fdev is
+ * 6.25KHz per FD step. 100k runs the system clock at Fmsck/2 and an IF
+ * of 200KHz for the wider filter.
  */
-uint16_t rate_cal_tab[] = {
-    0x3023,             // 2k
-    0x1223,             // 5k
-    0x0823,             // 10k
-    0x0223,             // 25k
-    0x0023,             // 50k
+struct rf_rate_profile {
+    uint16_t sysclk;                /* SYSTEMCLOCK_REG, CSC and SDR */
+    uint16_t rx1;                   /* RX1_REG, IF filter bandwidth */
+    uint16_t tx1;                   /* TX1_PAGEA, frequency deviation */
+    uint16_t if1;                   /* IF1_PAGEB, Auto-IF and IF */
 };
 
-static struct rf_dev devs[] = {
-    {
-        .name_alias = "a7139-1",
-        .irq        = -1,
-        .pin        = {
-            .scs        = GPIO_SCS,
-            .sck        = GPIO_SCK,
-            .sdio       = GPIO_SDIO,
-            .gio1       = GPIO_GIO1,
-        },
-        .rf_currmode    = A7139_MODE_STANDBY,
-        .rf_datarate    = RF_DEF_RATE,
-        .rf_freq_ch     = RF_DEF_FREQ_CH,
-        .rf_id          = {RF_DEF_ID_D0, RF_DEF_ID_D1},
-    },
+static const struct rf_rate_profile rate_profile_tab[A7139_RATE_MAX] = {
+    /* sysclk   rx1     tx1     if1 */
+    { 0x3023, 0x1850, 0x1703, 0x8200 },     // 2k, IFBW 50KHz, Fdev 18.75KHz
+    { 0x1223, 0x1850, 0x1703, 0x8200 },     // 5k, IFBW 50KHz, Fdev 18.75KHz
+    { 0x0823, 0x1850, 0x1703, 0x8200 },     // 10k, IFBW 50KHz, Fdev 18.75KHz
+    { 0x0223, 0x1854, 0x1703, 0x8200 },     // 25k, IFBW 100KHz, Fdev 18.75KHz
+    { 0x0023, 0x1854, 0x1703, 0x8200 },     // 50k, IFBW 100KHz, Fdev 18.75KHz
+    { 0x0021, 0x1858, 0x1704, 0x8400 },     // 100k, IFBW 150KHz, Fdev 25KHz
+};
+
+/* the board's single radio, registered when neither a board file nor the device tree declare one */
+static struct a7139_platform_data a7139_legacy_pdata = {
+    .scs        = GPIO_SCS,
+    .sck        = GPIO_SCK,
+    .sdio       = GPIO_SDIO,
+    .gio1       = GPIO_GIO1,
 };
 
 
@@ -250,8 +509,55 @@ static uint8_t id_tab[8] = {0xAA,0x75,0xC5,0x8C,0xC7,0x33,0x45,0xE7};   //ID cod
 #endif
 
 
-static int a7139_major = A7139_MAJOR;
+static dev_t a7139_devt;
 static struct class *dev_class;
+static struct dentry *a7139_debugfs;
+static DEFINE_IDA(a7139_ida);
+static atomic_t a7139_probed = ATOMIC_INIT(0);
+static struct platform_device *a7139_legacy;
+
+static bool legacy = 1;
+module_param(legacy, bool, S_IRUGO);
+MODULE_PARM_DESC(legacy, "Register one radio on the fixed GPIO3 pins when no board or device tree radio exists");
+
+static int spi_bus = -1;
+module_param(spi_bus, int, S_IRUGO);
+MODULE_PARM_DESC(spi_bus, "McSPI bus number the legacy radio is wired to, -1 to use gpio bit-bang");
+
+static int spi_cs = 0;
+module_param(spi_cs, int, S_IRUGO);
+MODULE_PARM_DESC(spi_cs, "McSPI chip select of the legacy radio");
+
+static int spi_speed = A7139_SPI_DEF_SPEED;
+module_param(spi_speed, int, S_IRUGO);
+MODULE_PARM_DESC(spi_speed, "McSPI SCK rate in Hz, default of radios without one");
+
+static bool gpio_mmio = 1;
+module_param(gpio_mmio, bool, S_IRUGO);
+MODULE_PARM_DESC(gpio_mmio, "Bit-bang through the mapped GPIO bank registers, 0 to use gpiolib");
+
+static int rx_frames = RF_RX_FRAMES;
+module_param(rx_frames, int, S_IRUGO);
+MODULE_PARM_DESC(rx_frames, "Number of received frames buffered per open file until read(), 1..1024");
+
+static int tx_frames = RF_TX_FRAMES;
+module_param(tx_frames, int, S_IRUGO);
+MODULE_PARM_DESC(tx_frames, "Number of frames write() can queue for sending, 1..256");
+
+static int frame_max = RF_BUFSIZE;
+module_param(frame_max, int, S_IRUGO);
+MODULE_PARM_DESC(frame_max, "Longest frame in bytes, above 64 frames stream through the FIFO extension, both ends must agree");
+
+static int irq_prio = MAX_USER_RT_PRIO / 2;
+module_param(irq_prio, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(irq_prio, "SCHED_FIFO priority of the irq thread, 0 for SCHED_NORMAL, taken on first open");
+
+static inline void a7139_sck_delay(struct rf_dev *dev)
+{
+    if (dev->half_ns) {
+        spi_ndelay(dev->half_ns);
+    }
+}
 
 
 //**********************************************************************************
@@ -271,9 +577,9 @@ static void a7139_byte_send(struct rf_dev *dev, uint8_t src)
             gpio_pin_l(dev->pin.sdio);
         }
 
-        spi_defdelay();
+        a7139_sck_delay(dev);
         gpio_pin_h(dev->pin.sck);
-        spi_defdelay();
+        a7139_sck_delay(dev);
         gpio_pin_l(dev->pin.sck);
 
         src = src << 1;
@@ -290,9 +596,7 @@ static uint8_t a7139_byte_read(struct rf_dev *dev)
 {
     uint8_t i, tmp = 0;
 
-    gpio_pin_h(dev->pin.sdio);      // SDIO pull high
-    gpio_pin_mi(dev->pin.sdio);     // change SDIO input
-
+    /* SDIO is switched to input once per frame by the caller */
     for (i = 0; i < 8; i++)         // Read one byte data
     {
         if (gpio_pin_in(dev->pin.sdio)) {
@@ -301,1261 +605,3157 @@ static uint8_t a7139_byte_read(struct rf_dev *dev)
             tmp = tmp << 1;
         }
 
-        spi_defdelay();
+        a7139_sck_delay(dev);
         gpio_pin_h(dev->pin.sck);
-        spi_defdelay();
+        a7139_sck_delay(dev);
         gpio_pin_l(dev->pin.sck);
     }
 
-    // ӦýSDIOλ.Ϊܶдûλ.޸
-    gpio_pin_mo_l(dev->pin.sdio);
-
     return tmp;     // Return tmp value.
 }
 
-//**********************************************************************************
-//  : Ϳ
-//  : uint8_t cmd
-// ز : 
-// ˵     :
-//**********************************************************************************
-static void a7139_send_ctrl(struct rf_dev *dev, uint8_t cmd)
+/*********************************************************************
+ ** gpio bit-bang bus
+ *********************************************************************/
+static void a7139_gpio_write(struct rf_dev *dev, uint8_t cmd, const uint8_t *buf, int len)
 {
-    gpio_pin_l(dev->pin.scs);
-    gpio_pin_mo_l(dev->pin.sdio);
+    int i;
+    unsigned long flags;
+
+    local_irq_save(flags);
+
+    gpio_pin_l(dev->pin.scs);       // Set SCS=0 to Enable SPI interface
+    gpio_pin_mo_h(dev->pin.sdio);   // change SDIO output
 
     a7139_byte_send(dev, cmd);
+    for (i = 0; i < len; i++) {
+        a7139_byte_send(dev, buf[i]);
+    }
+
+    gpio_pin_h(dev->pin.scs);       // Set SCS=1 to disable SPI interface.
 
-    gpio_pin_h(dev->pin.scs);
+    local_irq_restore(flags);
 }
 
-//**********************************************************************************
-//  : дĴ
-//  : uint8_t addressַ uint16_t dataWord
-// ز : 
-// ˵     :
-//**********************************************************************************
-static void a7139_write_reg(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+static void a7139_gpio_read(struct rf_dev *dev, uint8_t cmd, uint8_t *buf, int len)
 {
-    uint8_t dataWord1;
-    uint8_t dataWord0;
+    int i;
+    unsigned long flags;
 
-    dataWord0 = (dataWord) & 0x00ff;
-    dataWord1 = (dataWord >> 8) & 0x00ff;
+    local_irq_save(flags);
 
     gpio_pin_l(dev->pin.scs);       // Set SCS=0 to Enable SPI interface
     gpio_pin_mo_h(dev->pin.sdio);   // change SDIO output
 
-    address |= CMD_CTRLW;           // Enable write operation of control registers
-    a7139_byte_send(dev, address);       // Assign control register's address by input variable addr
+    a7139_byte_send(dev, cmd);
 
     spi_defdelay();
 
-    a7139_byte_send(dev, dataWord1);     // Assign control register's value by input variable dataByte
-    a7139_byte_send(dev, dataWord0);
+    gpio_pin_h(dev->pin.sdio);      // SDIO pull high
+    gpio_pin_mi(dev->pin.sdio);     // change SDIO input
+
+    for (i = 0; i < len; i++) {
+        buf[i] = a7139_byte_read(dev);
+    }
 
     gpio_pin_h(dev->pin.scs);       // Set SCS=1 to disable SPI interface.
+    gpio_pin_mo_h(dev->pin.sdio);
+
+    local_irq_restore(flags);
 }
 
-//**********************************************************************************
-//  : Ĵ
-//  : uint8_t addressַ
-// ز : Ĵֵ
-// ˵     :
-//**********************************************************************************
-static uint16_t a7139_read_reg(struct rf_dev *dev, uint8_t address)
-{
-    uint16_t tmp;
+static const struct rf_bus_ops a7139_gpio_ops = {
+    .name   = "gpio",
+    .write  = a7139_gpio_write,
+    .read   = a7139_gpio_read,
+};
 
-    gpio_pin_l(dev->pin.scs);       // Set SCS=0 to enable SPI write function.
-    gpio_pin_mo_h(dev->pin.sdio);   // change SDIO output
+/*********************************************************************
+ ** gpio bit-bang bus, direct bank register access
+ *********************************************************************/
+#define mmio_pin_h(dev, mask)   __raw_writel(mask, (dev)->gpio_base + AM335X_GPIO_SETDATAOUT)
+#define mmio_pin_l(dev, mask)   __raw_writel(mask, (dev)->gpio_base + AM335X_GPIO_CLEARDATAOUT)
+#define mmio_pin_in(dev, mask)  (__raw_readl((dev)->gpio_base + AM335X_GPIO_DATAIN) & (mask))
 
-    address |= CMD_CTRLR;       // Enable read operation of control registers.
-    a7139_byte_send(dev, address);
+/*
+ * OE is read-modify-write and shared with the other pins of the bank,
+ * the direction goes through gpiolib and its bank lock. Only the
+ * set/clear data registers are written directly.
+ */
+static void a7139_mmio_sdio_input(struct rf_dev *dev, int input)
+{
+    if (input) {
+        gpio_pin_mi(dev->pin.sdio);
+    } else {
+        gpio_pin_mo_h(dev->pin.sdio);
+    }
+}
 
-    spi_defdelay();
+static void a7139_mmio_byte_send(struct rf_dev *dev, uint8_t src)
+{
+    uint8_t i;
 
-    tmp = a7139_byte_read(dev) << 8;
-    tmp = (tmp & 0xff00) | (a7139_byte_read(dev) & 0x00ff);
+    for (i = 0; i < 8; i++) {
+        if (src & 0x80) {
+            mmio_pin_h(dev, dev->sdio_mask);
+        } else {
+            mmio_pin_l(dev, dev->sdio_mask);
+        }
 
-    gpio_pin_h(dev->pin.scs);       // Set SCS=1 to disable SPI interface.
-    gpio_pin_mo_h(dev->pin.sdio);   /* TRXEM_SDIO_MOǺȥ*/
+        a7139_sck_delay(dev);
+        mmio_pin_h(dev, dev->sck_mask);
+        a7139_sck_delay(dev);
+        mmio_pin_l(dev, dev->sck_mask);
 
-    return tmp;                 // Return 16 bit value
+        src = src << 1;
+    }
 }
 
-/************************************************************************
- **  A7139_WritePageA
- ************************************************************************/
-static void a7139_write_page_a(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+static uint8_t a7139_mmio_byte_read(struct rf_dev *dev)
 {
-    uint16_t tmp;
+    uint8_t i, tmp = 0;
 
-    tmp = address;
-    tmp = ((tmp << 12) | rf_reg_cfg[CRYSTAL_REG]);  /*it's different here*/
+    for (i = 0; i < 8; i++) {
+        tmp = (tmp << 1) | (mmio_pin_in(dev, dev->sdio_mask) ? 0x01 : 0x00);
 
-    a7139_write_reg(dev, CRYSTAL_REG, tmp);
-    a7139_write_reg(dev, PAGEA_REG, dataWord);
+        a7139_sck_delay(dev);
+        mmio_pin_h(dev, dev->sck_mask);
+        a7139_sck_delay(dev);
+        mmio_pin_l(dev, dev->sck_mask);
+    }
+
+    return tmp;
 }
 
-/************************************************************************
- **  A7139_ReadPageA
- ************************************************************************/
-static uint16_t a7139_read_page_a(struct rf_dev *dev, uint8_t address)
+static void a7139_mmio_write(struct rf_dev *dev, uint8_t cmd, const uint8_t *buf, int len)
 {
-    uint16_t tmp;
+    int i;
+    unsigned long flags;
 
-    tmp = address;
-    tmp = ((tmp << 12) | rf_reg_cfg[CRYSTAL_REG]);
+    local_irq_save(flags);
 
-    a7139_write_reg(dev, CRYSTAL_REG, tmp);
-    tmp = a7139_read_reg(dev, PAGEA_REG);
+    mmio_pin_l(dev, dev->scs_mask);
+
+    a7139_mmio_byte_send(dev, cmd);
+    for (i = 0; i < len; i++) {
+        a7139_mmio_byte_send(dev, buf[i]);
+    }
 
-    /*here lost  A7108_WriteReg(CRYSTAL_REG, temp_Crystal_Reg);
-      is it because never change CRYSTAL_REG?*/
+    mmio_pin_h(dev, dev->scs_mask);
 
-    return tmp;
+    local_irq_restore(flags);
 }
 
-/************************************************************************
- **  A7139_WritePageB
- ************************************************************************/
-static void a7139_write_page_b(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+static void a7139_mmio_read(struct rf_dev *dev, uint8_t cmd, uint8_t *buf, int len)
 {
-    uint16_t tmp;
+    int i;
+    unsigned long flags;
+
+    local_irq_save(flags);
 
-    tmp = address;
-    tmp = ((tmp << 7) | rf_reg_cfg[CRYSTAL_REG]);
+    mmio_pin_l(dev, dev->scs_mask);
 
-    a7139_write_reg(dev, CRYSTAL_REG, tmp);
-    a7139_write_reg(dev, PAGEB_REG, dataWord);
+    a7139_mmio_byte_send(dev, cmd);
+
+    spi_defdelay();
+
+    mmio_pin_h(dev, dev->sdio_mask);
+    a7139_mmio_sdio_input(dev, 1);
+
+    for (i = 0; i < len; i++) {
+        buf[i] = a7139_mmio_byte_read(dev);
+    }
+
+    mmio_pin_h(dev, dev->scs_mask);
+    a7139_mmio_sdio_input(dev, 0);
+
+    local_irq_restore(flags);
 }
 
-/************************************************************************
- **  A7139_ReadPageB
- ************************************************************************/
-static uint16_t a7139_read_page_b(struct rf_dev *dev, uint8_t address)
+static const struct rf_bus_ops a7139_mmio_ops = {
+    .name   = "gpio-mmio",
+    .write  = a7139_mmio_write,
+    .read   = a7139_mmio_read,
+};
+
+static int a7139_mmio_init(struct rf_dev *dev)
 {
-    uint16_t tmp;
+    int bank = dev->pin.sdio / 32;
 
-    tmp = address;
-    tmp = ((tmp << 7) | rf_reg_cfg[CRYSTAL_REG]);
+    if (dev->pin.scs / 32 != bank || dev->pin.sck / 32 != bank ||
+            bank >= ARRAY_SIZE(am335x_gpio_bank_base)) {
+        printk(KERN_ERR "%s: SCS/SCK/SDIO not in one gpio bank\n", dev->name_alias);
+        return -EINVAL;
+    }
 
-    a7139_write_reg(dev, CRYSTAL_REG, tmp);
-    tmp = a7139_read_reg(dev, PAGEB_REG);
+    dev->gpio_base = ioremap(am335x_gpio_bank_base[bank], AM335X_GPIO_BANK_SIZE);
+    if (!dev->gpio_base) {
+        return -ENOMEM;
+    }
 
-    return tmp;
-}
+    dev->scs_mask  = 1 << (dev->pin.scs % 32);
+    dev->sck_mask  = 1 << (dev->pin.sck % 32);
+    dev->sdio_mask = 1 << (dev->pin.sdio % 32);
 
+    return 0;
+}
 
-static void a7139_reg_dump(struct rf_dev *dev)
+/*
+ * Pad each SCK half period up to the chip's max rate: time a run of
+ * SCK toggles (SCS is high, so the chip ignores them) on the current
+ * bus and only delay for what the pin writes don't already take.
+ */
+static void a7139_sck_calibrate(struct rf_dev *dev)
 {
-    printk("RF Register Config:\n");
-    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
-    printk("%-15s%-6s0x%04X    0x%04X\n", "SYSTEMCLOCK", "R/W", rf_reg_cfg[SYSTEMCLOCK_REG], a7139_read_reg(dev, SYSTEMCLOCK_REG));
-    printk("%-15s%-6s0x%04X    -\n", "PLL1", "W", rf_reg_cfg[PLL1_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "PLL2", "W", rf_reg_cfg[PLL2_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "PLL3", "W", rf_reg_cfg[PLL3_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "PLL4", "W", rf_reg_cfg[PLL4_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "PLL5", "W", rf_reg_cfg[PLL5_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "PLL6", "W", rf_reg_cfg[PLL6_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "CRYSTAL", "W", rf_reg_cfg[CRYSTAL_REG]);
-    printk("%-15s%-6s0x%04X    -\n", "RX1", "W", rf_reg_cfg[RX1_REG]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "RX2", "R/W", rf_reg_cfg[RX2_REG], a7139_read_reg(dev, RX2_REG));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "ADC", "R/W", rf_reg_cfg[ADC_REG], a7139_read_reg(dev, ADC_REG));
-    printk("%-15s%-6s0x%04X    -\n", "PINCTRL", "W", rf_reg_cfg[PIN_REG]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "CALIBRATION", "R/W", rf_reg_cfg[CALIBRATION_REG], a7139_read_reg(dev, CALIBRATION_REG));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "MODE", "R/W", rf_reg_cfg[MODE_REG], a7139_read_reg(dev, MODE_REG));
+    unsigned int target_ns = DIV_ROUND_UP(1000000000, 2 * A7139_SCK_MAX_HZ);
+    unsigned int edge_ns;
+    unsigned long flags;
+    ktime_t start;
+    s64 ns;
+    int i;
 
-    printk("\nRF PageA Register Config:\n");
-    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
-    printk("%-15s%-6s0x%04X    -\n", "TX1", "W", rf_reg_cfg_page_a[TX1_PAGEA]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "WOR1", "R/W", rf_reg_cfg_page_a[WOR1_PAGEA], a7139_read_page_a(dev, WOR1_PAGEA));
-    printk("%-15s%-6s0x%04X    -\n", "WOR2", "W", rf_reg_cfg_page_a[WOR2_PAGEA]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "RFI", "R/W", rf_reg_cfg_page_a[RFI_PAGEA], a7139_read_page_a(dev, RFI_PAGEA));
-    printk("%-15s%-6s0x%04X    -\n", "PM", "W", rf_reg_cfg_page_a[PM_PAGEA]);
-    printk("%-15s%-6s0x%04X    -\n", "RTH", "W", rf_reg_cfg_page_a[RTH_PAGEA]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "AGC1", "R/W", rf_reg_cfg_page_a[AGC1_PAGEA], a7139_read_page_a(dev, AGC1_PAGEA));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "AGC2", "R/W", rf_reg_cfg_page_a[AGC2_PAGEA], a7139_read_page_a(dev, AGC2_PAGEA));
-    printk("%-15s%-6s0x%04X    -\n", "GIO", "W", rf_reg_cfg_page_a[GIO_PAGEA]);
-    printk("%-15s%-6s0x%04X    -\n", "CKO", "W", rf_reg_cfg_page_a[CKO_PAGEA]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "VCB", "R/W", rf_reg_cfg_page_a[VCB_PAGEA], a7139_read_page_a(dev, VCB_PAGEA));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "CHG1", "R/W", rf_reg_cfg_page_a[CHG1_PAGEA], a7139_read_page_a(dev, CHG1_PAGEA));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "CHG2", "R/W", rf_reg_cfg_page_a[CHG2_PAGEA], a7139_read_page_a(dev, CHG2_PAGEA));
-    printk("%-15s%-6s0x%04X    -\n", "FIFO", "W", rf_reg_cfg_page_a[FIFO_PAGEA]);
-    printk("%-15s%-6s0x%04X    -\n", "CODE", "W", rf_reg_cfg_page_a[CODE_PAGEA]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "WCAL", "R/W", rf_reg_cfg_page_a[WCAL_PAGEA], a7139_read_page_a(dev, WCAL_PAGEA));
+    if (dev->spi) {
+        dev->half_ns = 0;
+        return;
+    }
 
-    printk("\nRF PageB Register Config:\n");
-    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
-    printk("%-15s%-6s0x%04X    0x%04X\n", "TX2", "R/W", rf_reg_cfg_page_b[TX2_PAGEB], a7139_read_page_b(dev, TX2_PAGEB));
-    printk("%-15s%-6s0x%04X    -\n", "IF1", "W", rf_reg_cfg_page_b[IF1_PAGEB]);
-    printk("%-15s%-6s0x%04X    -\n", "IF2", "W", rf_reg_cfg_page_b[IF2_PAGEB]);
-    printk("%-15s%-6s0x%04X    0x%04X\n", "ACK", "R/W", rf_reg_cfg_page_b[ACK_PAGEB], a7139_read_page_b(dev, ACK_PAGEB));
-    printk("%-15s%-6s0x%04X    0x%04X\n", "ART", "R/W", rf_reg_cfg_page_b[ART_PAGEB], a7139_read_page_b(dev, ART_PAGEB));
+    local_irq_save(flags);
+    start = ktime_get();
+    for (i = 0; i < 64; i++) {
+        if (dev->bus == &a7139_mmio_ops) {
+            mmio_pin_h(dev, dev->sck_mask);
+            mmio_pin_l(dev, dev->sck_mask);
+        } else {
+            gpio_pin_h(dev->pin.sck);
+            gpio_pin_l(dev->pin.sck);
+        }
+    }
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    local_irq_restore(flags);
 
+    edge_ns = (unsigned int)(ns / 128);
+    dev->half_ns = (edge_ns < target_ns ? target_ns - edge_ns : 0);
 }
 
 /*********************************************************************
- ** A7139_Config
+ ** bus throughput benchmark, debugfs <name>/bench
  *********************************************************************/
-static int a7139_config(struct rf_dev *dev)
+static uint16_t a7139_bus_read_reg(struct rf_dev *dev, uint8_t address);
+static void a7139_bus_write_reg(struct rf_dev *dev, uint8_t address, uint16_t dataWord);
+
+static uint64_t a7139_bench_rate(uint64_t bytes, ktime_t start)
 {
-    uint8_t i;
-    uint16_t tmp;
+    s64 us = ktime_us_delta(ktime_get(), start);
 
-    for (i = 0; i < 8; i++) {
-        a7139_write_reg(dev, i, rf_reg_cfg[i]);
-    }
+    return div_u64(bytes * 1000000, us > 0 ? us : 1);
+}
 
-    for (i = 10; i < 16; i++) {
-        a7139_write_reg(dev, i, rf_reg_cfg[i]);
+static void a7139_bench_bus(struct rf_dev *dev, struct seq_file *s)
+{
+    uint8_t buf[RF_BUFSIZE];
+    uint64_t reg_rd, reg_wr, fifo_rd, fifo_wr;
+    uint16_t reg;
+    ktime_t start;
+    int i;
+
+    memset(buf, 0x55, sizeof(buf));
+    reg = a7139_bus_read_reg(dev, SYSTEMCLOCK_REG);
+
+    start = ktime_get();
+    for (i = 0; i < A7139_BENCH_REG_LOOPS; i++) {
+        a7139_bus_read_reg(dev, SYSTEMCLOCK_REG);
     }
+    reg_rd = a7139_bench_rate(A7139_BENCH_REG_LOOPS * 3, start);
 
-    for (i = 0; i < 16; i++) {
-        a7139_write_page_a(dev, i, rf_reg_cfg_page_a[i]);
+    start = ktime_get();
+    for (i = 0; i < A7139_BENCH_REG_LOOPS; i++) {
+        a7139_bus_write_reg(dev, SYSTEMCLOCK_REG, reg);
     }
+    reg_wr = a7139_bench_rate(A7139_BENCH_REG_LOOPS * 3, start);
 
-    for (i = 0; i < 5; i++) {
-        a7139_write_page_b(dev, i, rf_reg_cfg_page_b[i]);
+    start = ktime_get();
+    for (i = 0; i < A7139_BENCH_FIFO_LOOPS; i++) {
+        dev->bus->read(dev, CMD_DATAR, buf, RF_BUFSIZE);
     }
+    fifo_rd = a7139_bench_rate(A7139_BENCH_FIFO_LOOPS * (RF_BUFSIZE + 1), start);
 
-    // for check
-    tmp = a7139_read_reg(dev, SYSTEMCLOCK_REG);
-    if (tmp != rf_reg_cfg[SYSTEMCLOCK_REG]) {
-        a7139_reg_dump(dev);
-        return -EIO;
+    start = ktime_get();
+    for (i = 0; i < A7139_BENCH_FIFO_LOOPS; i++) {
+        dev->bus->write(dev, CMD_DATAW, buf, RF_BUFSIZE);
     }
+    fifo_wr = a7139_bench_rate(A7139_BENCH_FIFO_LOOPS * (RF_BUFSIZE + 1), start);
 
-    return 0;
+    seq_printf(s, "%-10s%-8u%-12llu%-12llu%-12llu%-12llu\n", dev->bus->name, dev->half_ns,
+            (unsigned long long)reg_rd, (unsigned long long)reg_wr,
+            (unsigned long long)fifo_rd, (unsigned long long)fifo_wr);
 }
 
-/************************************************************************
- **  WriteID
- ************************************************************************/
-static int a7139_write_id(struct rf_dev *dev, uint8_t *id)
+static int a7139_bench_show(struct seq_file *s, void *data)
 {
-    uint8_t i;
-    int ret = 0;
+    struct rf_dev *dev = s->private;
+    const struct rf_bus_ops *saved;
 
-    gpio_pin_l(dev->pin.scs);
-    a7139_byte_send(dev, CMD_ID_W);
-
-    for (i = 0; i < RF_IDSIZE; i++) {
-        dev->rf_id[i] = id[i];
-        a7139_byte_send(dev, dev->rf_id[i]);
+    /* only on an idle radio: the FIFOs are overwritten, no irq is requested */
+    if (mutex_lock_interruptible(&dev->open_lock)) {
+        return -ERESTARTSYS;
+    }
+    if (dev->opencount) {
+        mutex_unlock(&dev->open_lock);
+        return -EBUSY;
     }
+    down(&dev->sem);
 
-    gpio_pin_h(dev->pin.scs);
-    gpio_pin_l(dev->pin.scs);
+    seq_printf(s, "%-10s%-8s%-12s%-12s%-12s%-12s\n", "bus", "half_ns",
+            "reg_rd B/s", "reg_wr B/s", "fifo_rd B/s", "fifo_wr B/s");
 
-    a7139_byte_send(dev, CMD_ID_R);
+    saved = dev->bus;
 
-    for (i = 0; i < RF_IDSIZE; i++) {
-        ret += (a7139_byte_read(dev) == dev->rf_id[i] ? 0 : -1);
+    if (dev->spi) {
+        a7139_bench_bus(dev, s);
+    } else {
+        dev->bus = &a7139_gpio_ops;
+        a7139_sck_calibrate(dev);
+        a7139_bench_bus(dev, s);
+
+        if (dev->gpio_base) {
+            dev->bus = &a7139_mmio_ops;
+            a7139_sck_calibrate(dev);
+            a7139_bench_bus(dev, s);
+        }
     }
 
-    gpio_pin_h(dev->pin.scs);
+    dev->bus = saved;
+    a7139_sck_calibrate(dev);
 
-    return ret;
+    /* the FIFO pointers were moved, restart them */
+    dev->bus->write(dev, CMD_TFR, NULL, 0);
+    dev->bus->write(dev, CMD_RFR, NULL, 0);
+
+    up(&dev->sem);
+    mutex_unlock(&dev->open_lock);
+
+    return 0;
 }
 
-/************************************************************************
- **  ReadID
- ************************************************************************/
-static int a7139_read_id(struct rf_dev *dev, uint8_t *id)
+static int a7139_bench_open(struct inode *inode, struct file *file)
 {
-    uint8_t i;
-    int ret = 0;
+    return single_open(file, a7139_bench_show, inode->i_private);
+}
 
-    gpio_pin_l(dev->pin.scs);
+static const struct file_operations a7139_bench_fops = {
+    .owner      = THIS_MODULE,
+    .open       = a7139_bench_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/*********************************************************************
+ ** statistics, debugfs <name>/stats
+ *********************************************************************/
+static void a7139_hist_add(uint32_t *hist, s64 start_ns, ktime_t end)
+{
+    s64 us = div_s64(ktime_to_ns(end) - start_ns, 1000);
+    int b;
 
-    a7139_byte_send(dev, CMD_ID_R);
+    /* bucket b holds [2^(b-1), 2^b) us, bucket 0 is below 1us */
+    b = (us > 0 ? fls((uint32_t)min_t(s64, us, INT_MAX)) : 0);
+    hist[min(b, A7139_HIST_BUCKETS - 1)]++;
+}
 
-    for (i = 0; i < RF_IDSIZE; i++) {
-        ret += ((id[i] = a7139_byte_read(dev)) == dev->rf_id[i] ? 0 : -1);
+static void a7139_hist_show(struct seq_file *s, const char *name, const uint32_t *hist)
+{
+    int i;
+
+    seq_printf(s, "\n%s:\n", name);
+    for (i = 0; i < A7139_HIST_BUCKETS - 1; i++) {
+        seq_printf(s, "  %8u-%-8u us %u\n", i ? 1U << (i - 1) : 0, (1U << i) - 1, hist[i]);
     }
+    seq_printf(s, "  %8u-%-8s us %u\n", 1U << (i - 1), "", hist[i]);
+}
 
-    gpio_pin_h(dev->pin.scs);
+static int a7139_stats_show(struct seq_file *s, void *data)
+{
+    struct rf_dev *dev = s->private;
+    struct rf_stats *st = &dev->stats;
+
+    seq_printf(s, "%-16s%u\n", "irqs", st->irqs);
+    seq_printf(s, "%-16s%u\n", "irqs_stale", st->irqs_stale);
+    seq_printf(s, "%-16s%u\n", "rx_frames", st->rx_frames);
+    seq_printf(s, "%-16s%u\n", "rx_crc_err", st->rx_crc_err);
+    seq_printf(s, "%-16s%u\n", "rx_dropped", st->rx_dropped);
+    seq_printf(s, "%-16s%u\n", "rx_filtered", st->rx_filtered);
+    seq_printf(s, "%-16s%u\n", "tx_frames", st->tx_frames);
+    seq_printf(s, "%-16s%u\n", "tx_timeouts", st->tx_timeouts);
+    seq_printf(s, "%-16s%u\n", "mode_switches", st->mode_switches);
+    seq_printf(s, "%-16s%u\n", "cal_failures", st->cal_failures);
+    seq_printf(s, "%-16s%u\n", "lbt_deferrals", st->lbt_deferrals);
+    seq_printf(s, "%-16s%u\n", "lbt_abandoned", st->lbt_abandoned);
+
+    a7139_hist_show(s, "irq_to_read", st->irq_to_read);
+    a7139_hist_show(s, "write_to_txdone", st->write_to_txdone);
 
-    return ret;
+    return 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-//  : ģʽл
-//  : 
+static int a7139_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, a7139_stats_show, inode->i_private);
+}
+
+/* echo 0 > stats clears every counter, anything else is refused */
+static ssize_t a7139_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct rf_dev *dev = ((struct seq_file *)file->private_data)->private;
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint_from_user(buf, count, 0, &val);
+    if (ret) {
+        return ret;
+    }
+    if (val) {
+        return -EINVAL;
+    }
+
+    /* the thread counts under the sem, the hard irq under irq_lock */
+    down(&dev->sem);
+    spin_lock_irq(&dev->irq_lock);
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    spin_unlock_irq(&dev->irq_lock);
+    up(&dev->sem);
+
+    return count;
+}
+
+static const struct file_operations a7139_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = a7139_stats_open,
+    .read       = seq_read,
+    .write      = a7139_stats_write,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/*********************************************************************
+ ** McSPI bus, half duplex 3-wire, may sleep
+ *********************************************************************/
+static void a7139_spi_write(struct rf_dev *dev, uint8_t cmd, const uint8_t *buf, int len)
+{
+    struct spi_transfer t = {
+        .tx_buf = dev->xfer_buf,
+        .len    = len + 1,
+    };
+    struct spi_message m;
+    int ret;
+
+    mutex_lock(&dev->bus_lock);
+
+    dev->xfer_buf[0] = cmd;
+    if (len) {
+        memcpy(dev->xfer_buf + 1, buf, len);
+    }
+
+    spi_message_init(&m);
+    spi_message_add_tail(&t, &m);
+    ret = spi_sync(dev->spi, &m);
+
+    mutex_unlock(&dev->bus_lock);
+
+    if (ret) {
+        printk(KERN_ERR "%s: spi write 0x%02x error %d\n", dev->name_alias, cmd, ret);
+    }
+}
+
+static void a7139_spi_read(struct rf_dev *dev, uint8_t cmd, uint8_t *buf, int len)
+{
+    struct spi_transfer t[2] = {
+        {
+            .tx_buf = dev->xfer_buf,
+            .len    = 1,
+        },
+        {
+            .rx_buf = dev->xfer_buf + 1,
+            .len    = len,
+        },
+    };
+    struct spi_message m;
+    int ret;
+
+    mutex_lock(&dev->bus_lock);
+
+    dev->xfer_buf[0] = cmd;
+
+    spi_message_init(&m);
+    spi_message_add_tail(&t[0], &m);
+    spi_message_add_tail(&t[1], &m);
+    ret = spi_sync(dev->spi, &m);
+
+    memcpy(buf, dev->xfer_buf + 1, len);
+
+    mutex_unlock(&dev->bus_lock);
+
+    if (ret) {
+        printk(KERN_ERR "%s: spi read 0x%02x error %d\n", dev->name_alias, cmd, ret);
+    }
+}
+
+static const struct rf_bus_ops a7139_spi_ops = {
+    .name   = "mcspi",
+    .write  = a7139_spi_write,
+    .read   = a7139_spi_read,
+};
+
+static int a7139_spi_init(struct rf_dev *dev, int bus, int cs)
+{
+    struct spi_master *master;
+    struct spi_board_info info = {
+        .modalias       = DEVICE_NAME,
+        .max_speed_hz   = dev->spi_speed,
+        .bus_num        = bus,
+        .chip_select    = cs,
+        .mode           = SPI_MODE_0 | SPI_3WIRE,
+    };
+
+    master = spi_busnum_to_master(bus);
+    if (!master) {
+        printk(KERN_ERR "%s: no spi master on bus %d\n", dev->name_alias, bus);
+        return -ENODEV;
+    }
+
+    /* spi_setup() rejects the device if the controller can't do 3-wire */
+    dev->spi = spi_new_device(master, &info);
+    spi_master_put(master);
+    if (!dev->spi) {
+        printk(KERN_ERR "%s: can't add spi device %d.%d\n", dev->name_alias, bus, cs);
+        return -ENODEV;
+    }
+
+    dev->xfer_buf = kmalloc(A7139_XFER_BUFSIZE, GFP_KERNEL);
+    if (!dev->xfer_buf) {
+        spi_unregister_device(dev->spi);
+        dev->spi = NULL;
+        return -ENOMEM;
+    }
+
+    mutex_init(&dev->bus_lock);
+    dev->bus = &a7139_spi_ops;
+
+    return 0;
+}
+
+static void a7139_spi_free(struct rf_dev *dev)
+{
+    if (dev->spi) {
+        spi_unregister_device(dev->spi);
+        dev->spi = NULL;
+    }
+
+    kfree(dev->xfer_buf);
+    dev->xfer_buf = NULL;
+}
+
+/*****
+ ** register shadow
+ *****/
+/* status read back, self-clearing or reading back other than written, always go to the chip */
+static const uint16_t a7139_shadow_volatile[A7139_SHADOW_FILES] = {
+    [A7139_SHADOW_MAIN]   = (1 << SYSTEMCLOCK_REG) | (1 << PAGEA_REG) | (1 << PAGEB_REG) |
+                            (1 << RX2_REG) | (1 << ADC_REG) | (1 << CALIBRATION_REG) | (1 << MODE_REG),
+    [A7139_SHADOW_PAGE_A] = (1 << WOR1_PAGEA) | (1 << RFI_PAGEA) | (1 << AGC1_PAGEA) |
+                            (1 << AGC2_PAGEA) | (1 << VCB_PAGEA) | (1 << CHG1_PAGEA) |
+                            (1 << CHG2_PAGEA) | (1 << WCAL_PAGEA),
+    [A7139_SHADOW_PAGE_B] = (1 << TX2_PAGEB) | (1 << ACK_PAGEB) | (1 << ART_PAGEB),
+};
+
+static inline bool a7139_shadow_get(struct rf_dev *dev, int file, uint8_t address, uint16_t *val)
+{
+    if (!(dev->shadow_valid[file] & (1 << address))) {
+        return false;
+    }
+
+    *val = dev->shadow[file][address];
+    return true;
+}
+
+/* only writes fill the shadow, most registers read back something else */
+static inline void a7139_shadow_set(struct rf_dev *dev, int file, uint8_t address, uint16_t val)
+{
+    if (a7139_shadow_volatile[file] & (1 << address)) {
+        return;
+    }
+
+    dev->shadow[file][address] = val;
+    dev->shadow_valid[file] |= (1 << address);
+}
+
+static void a7139_shadow_reset(struct rf_dev *dev)
+{
+    memset(dev->shadow_valid, 0, sizeof(dev->shadow_valid));
+    dev->id_valid = 0;
+}
+
+//**********************************************************************************
+//  : Ϳ
+//  : uint8_t cmd
+// ز : 
+// ˵     :
+//**********************************************************************************
+static void a7139_send_ctrl(struct rf_dev *dev, uint8_t cmd)
+{
+    dev->bus->write(dev, cmd, NULL, 0);
+
+    /* registers are back to power-on values */
+    if (cmd == CMD_RF_RST || cmd == CMD_DEEP_SLEEP_T || cmd == CMD_DEEP_SLEEP_P) {
+        a7139_shadow_reset(dev);
+    }
+}
+
+static void a7139_bus_write_reg(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+{
+    uint8_t data[2];
+
+    data[0] = (dataWord >> 8) & 0x00ff;
+    data[1] = (dataWord) & 0x00ff;
+
+    address |= CMD_CTRLW;           // Enable write operation of control registers
+    dev->bus->write(dev, address, data, sizeof(data));
+}
+
+static uint16_t a7139_bus_read_reg(struct rf_dev *dev, uint8_t address)
+{
+    uint8_t data[2];
+
+    address |= CMD_CTRLR;       // Enable read operation of control registers.
+    dev->bus->read(dev, address, data, sizeof(data));
+
+    return (data[0] << 8) | data[1];    // Return 16 bit value
+}
+
+//**********************************************************************************
+//  : дĴ
+//  : uint8_t addressַ uint16_t dataWord
+// ز : 
+// ˵     :
+//**********************************************************************************
+static void a7139_write_reg(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+{
+    uint16_t cur;
+
+    if (a7139_shadow_get(dev, A7139_SHADOW_MAIN, address, &cur) && cur == dataWord) {
+        dev->reg_saved++;
+        return;
+    }
+
+    a7139_bus_write_reg(dev, address, dataWord);
+    a7139_shadow_set(dev, A7139_SHADOW_MAIN, address, dataWord);
+}
+
+//**********************************************************************************
+//  : Ĵ
+//  : uint8_t addressַ
+// ز : Ĵֵ
+// ˵     :
+//**********************************************************************************
+static uint16_t a7139_read_reg(struct rf_dev *dev, uint8_t address)
+{
+    uint16_t val;
+
+    if (a7139_shadow_get(dev, A7139_SHADOW_MAIN, address, &val)) {
+        dev->reg_saved++;
+        return val;
+    }
+
+    return a7139_bus_read_reg(dev, address);
+}
+
+/*
+ * point the CRYSTAL_REG page select at address, keeping the other
+ * page's select so alternating page A/B accesses stay cheap
+ */
+static void a7139_page_select(struct rf_dev *dev, uint16_t mask, int shift, uint8_t address)
+{
+    uint16_t tmp;
+
+    if (!a7139_shadow_get(dev, A7139_SHADOW_MAIN, CRYSTAL_REG, &tmp)) {
+        tmp = rf_reg_cfg[CRYSTAL_REG];
+    }
+
+    tmp = (tmp & ~mask) | ((uint16_t)address << shift);
+    a7139_write_reg(dev, CRYSTAL_REG, tmp);
+}
+
+static void a7139_write_page(struct rf_dev *dev, int file, uint8_t address, uint16_t dataWord)
+{
+    uint16_t cur;
+
+    if (a7139_shadow_get(dev, file, address, &cur) && cur == dataWord) {
+        dev->reg_saved += 2;
+        return;
+    }
+
+    if (file == A7139_SHADOW_PAGE_A) {
+        a7139_page_select(dev, A7139_CRYSTAL_PAGEA, 12, address);
+        a7139_bus_write_reg(dev, PAGEA_REG, dataWord);
+    } else {
+        a7139_page_select(dev, A7139_CRYSTAL_PAGEB, 7, address);
+        a7139_bus_write_reg(dev, PAGEB_REG, dataWord);
+    }
+    a7139_shadow_set(dev, file, address, dataWord);
+}
+
+/* the chip's value, never the shadow */
+static uint16_t a7139_bus_read_page(struct rf_dev *dev, int file, uint8_t address)
+{
+    if (file == A7139_SHADOW_PAGE_A) {
+        a7139_page_select(dev, A7139_CRYSTAL_PAGEA, 12, address);
+        return a7139_bus_read_reg(dev, PAGEA_REG);
+    }
+
+    a7139_page_select(dev, A7139_CRYSTAL_PAGEB, 7, address);
+    return a7139_bus_read_reg(dev, PAGEB_REG);
+}
+
+static uint16_t a7139_read_page(struct rf_dev *dev, int file, uint8_t address)
+{
+    uint16_t val;
+
+    if (a7139_shadow_get(dev, file, address, &val)) {
+        dev->reg_saved += 2;
+        return val;
+    }
+
+    return a7139_bus_read_page(dev, file, address);
+}
+
+/************************************************************************
+ **  A7139_WritePageA
+ ************************************************************************/
+static void a7139_write_page_a(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+{
+    a7139_write_page(dev, A7139_SHADOW_PAGE_A, address, dataWord);
+}
+
+/************************************************************************
+ **  A7139_ReadPageA
+ ************************************************************************/
+static uint16_t a7139_read_page_a(struct rf_dev *dev, uint8_t address)
+{
+    return a7139_read_page(dev, A7139_SHADOW_PAGE_A, address);
+}
+
+/************************************************************************
+ **  A7139_WritePageB
+ ************************************************************************/
+static void a7139_write_page_b(struct rf_dev *dev, uint8_t address, uint16_t dataWord)
+{
+    a7139_write_page(dev, A7139_SHADOW_PAGE_B, address, dataWord);
+}
+
+/************************************************************************
+ **  A7139_ReadPageB
+ ************************************************************************/
+static uint16_t a7139_read_page_b(struct rf_dev *dev, uint8_t address)
+{
+    return a7139_read_page(dev, A7139_SHADOW_PAGE_B, address);
+}
+
+
+/* write-only register, the shadow is the only copy of what was written */
+static void a7139_reg_dump_wo(struct rf_dev *dev, const char *name, uint16_t def, int file, uint8_t address)
+{
+    uint16_t val;
+
+    if (a7139_shadow_get(dev, file, address, &val)) {
+        printk("%-15s%-6s0x%04X    0x%04X\n", name, "W", def, val);
+    } else {
+        printk("%-15s%-6s0x%04X    -\n", name, "W", def);
+    }
+}
+
+static void a7139_reg_dump(struct rf_dev *dev)
+{
+    /* what the chip reads back, the shadow only stands in for write-only registers */
+    printk("RF Register Config:\n");
+    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
+    printk("%-15s%-6s0x%04X    0x%04X\n", "SYSTEMCLOCK", "R/W", rf_reg_cfg[SYSTEMCLOCK_REG], a7139_bus_read_reg(dev, SYSTEMCLOCK_REG));
+    a7139_reg_dump_wo(dev, "PLL1", rf_reg_cfg[PLL1_REG], A7139_SHADOW_MAIN, PLL1_REG);
+    a7139_reg_dump_wo(dev, "PLL2", rf_reg_cfg[PLL2_REG], A7139_SHADOW_MAIN, PLL2_REG);
+    a7139_reg_dump_wo(dev, "PLL3", rf_reg_cfg[PLL3_REG], A7139_SHADOW_MAIN, PLL3_REG);
+    a7139_reg_dump_wo(dev, "PLL4", rf_reg_cfg[PLL4_REG], A7139_SHADOW_MAIN, PLL4_REG);
+    a7139_reg_dump_wo(dev, "PLL5", rf_reg_cfg[PLL5_REG], A7139_SHADOW_MAIN, PLL5_REG);
+    a7139_reg_dump_wo(dev, "PLL6", rf_reg_cfg[PLL6_REG], A7139_SHADOW_MAIN, PLL6_REG);
+    a7139_reg_dump_wo(dev, "CRYSTAL", rf_reg_cfg[CRYSTAL_REG], A7139_SHADOW_MAIN, CRYSTAL_REG);
+    a7139_reg_dump_wo(dev, "RX1", rf_reg_cfg[RX1_REG], A7139_SHADOW_MAIN, RX1_REG);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "RX2", "R/W", rf_reg_cfg[RX2_REG], a7139_bus_read_reg(dev, RX2_REG));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "ADC", "R/W", rf_reg_cfg[ADC_REG], a7139_bus_read_reg(dev, ADC_REG));
+    a7139_reg_dump_wo(dev, "PINCTRL", rf_reg_cfg[PIN_REG], A7139_SHADOW_MAIN, PIN_REG);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "CALIBRATION", "R/W", rf_reg_cfg[CALIBRATION_REG], a7139_bus_read_reg(dev, CALIBRATION_REG));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "MODE", "R/W", rf_reg_cfg[MODE_REG], a7139_bus_read_reg(dev, MODE_REG));
+
+    printk("\nRF PageA Register Config:\n");
+    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
+    a7139_reg_dump_wo(dev, "TX1", rf_reg_cfg_page_a[TX1_PAGEA], A7139_SHADOW_PAGE_A, TX1_PAGEA);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "WOR1", "R/W", rf_reg_cfg_page_a[WOR1_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, WOR1_PAGEA));
+    a7139_reg_dump_wo(dev, "WOR2", rf_reg_cfg_page_a[WOR2_PAGEA], A7139_SHADOW_PAGE_A, WOR2_PAGEA);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "RFI", "R/W", rf_reg_cfg_page_a[RFI_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, RFI_PAGEA));
+    a7139_reg_dump_wo(dev, "PM", rf_reg_cfg_page_a[PM_PAGEA], A7139_SHADOW_PAGE_A, PM_PAGEA);
+    a7139_reg_dump_wo(dev, "RTH", rf_reg_cfg_page_a[RTH_PAGEA], A7139_SHADOW_PAGE_A, RTH_PAGEA);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "AGC1", "R/W", rf_reg_cfg_page_a[AGC1_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, AGC1_PAGEA));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "AGC2", "R/W", rf_reg_cfg_page_a[AGC2_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, AGC2_PAGEA));
+    a7139_reg_dump_wo(dev, "GIO", rf_reg_cfg_page_a[GIO_PAGEA], A7139_SHADOW_PAGE_A, GIO_PAGEA);
+    a7139_reg_dump_wo(dev, "CKO", rf_reg_cfg_page_a[CKO_PAGEA], A7139_SHADOW_PAGE_A, CKO_PAGEA);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "VCB", "R/W", rf_reg_cfg_page_a[VCB_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, VCB_PAGEA));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "CHG1", "R/W", rf_reg_cfg_page_a[CHG1_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, CHG1_PAGEA));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "CHG2", "R/W", rf_reg_cfg_page_a[CHG2_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, CHG2_PAGEA));
+    a7139_reg_dump_wo(dev, "FIFO", rf_reg_cfg_page_a[FIFO_PAGEA], A7139_SHADOW_PAGE_A, FIFO_PAGEA);
+    a7139_reg_dump_wo(dev, "CODE", rf_reg_cfg_page_a[CODE_PAGEA], A7139_SHADOW_PAGE_A, CODE_PAGEA);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "WCAL", "R/W", rf_reg_cfg_page_a[WCAL_PAGEA], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_A, WCAL_PAGEA));
+
+    printk("\nRF PageB Register Config:\n");
+    printk("%-15s%-6s%-10s%-10s\n", "Reg Name", "R/W", "DefValue", "CurrValue");
+    printk("%-15s%-6s0x%04X    0x%04X\n", "TX2", "R/W", rf_reg_cfg_page_b[TX2_PAGEB], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_B, TX2_PAGEB));
+    a7139_reg_dump_wo(dev, "IF1", rf_reg_cfg_page_b[IF1_PAGEB], A7139_SHADOW_PAGE_B, IF1_PAGEB);
+    a7139_reg_dump_wo(dev, "IF2", rf_reg_cfg_page_b[IF2_PAGEB], A7139_SHADOW_PAGE_B, IF2_PAGEB);
+    printk("%-15s%-6s0x%04X    0x%04X\n", "ACK", "R/W", rf_reg_cfg_page_b[ACK_PAGEB], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_B, ACK_PAGEB));
+    printk("%-15s%-6s0x%04X    0x%04X\n", "ART", "R/W", rf_reg_cfg_page_b[ART_PAGEB], a7139_bus_read_page(dev, A7139_SHADOW_PAGE_B, ART_PAGEB));
+
+}
+
+/*********************************************************************
+ ** A7139_Config
+ *********************************************************************/
+static int a7139_config(struct rf_dev *dev)
+{
+    uint8_t i;
+    uint16_t tmp;
+
+    for (i = 0; i < 8; i++) {
+        a7139_write_reg(dev, i, rf_reg_cfg[i]);
+    }
+
+    for (i = 10; i < 16; i++) {
+        a7139_write_reg(dev, i, rf_reg_cfg[i]);
+    }
+
+    for (i = 0; i < 16; i++) {
+        a7139_write_page_a(dev, i, rf_reg_cfg_page_a[i]);
+    }
+
+    for (i = 0; i < 5; i++) {
+        a7139_write_page_b(dev, i, rf_reg_cfg_page_b[i]);
+    }
+
+    // for check, past the shadow
+    tmp = a7139_bus_read_reg(dev, SYSTEMCLOCK_REG);
+    if (tmp != rf_reg_cfg[SYSTEMCLOCK_REG]) {
+        a7139_reg_dump(dev);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*****
+ ** FIFO extension
+ *****/
+static inline bool a7139_frame_ext(struct rf_dev *dev)
+{
+    return dev->frame_max > RF_BUFSIZE;
+}
+
+/* bytes on air for a len byte payload, the last segment is never shorter than the chip allows */
+static unsigned int a7139_ext_air_len(unsigned int len)
+{
+    unsigned int air = A7139_EXT_HLEN + len + A7139_EXT_CRCLEN;
+
+    if (air <= RF_BUFSIZE) {
+        return RF_BUFSIZE;
+    }
+    if (air % RF_BUFSIZE < A7139_EXT_MIN_TAIL) {
+        air += A7139_EXT_MIN_TAIL - air % RF_BUFSIZE;
+    }
+
+    return air;
+}
+
+/* receive with INFS=1, a frame is drained on FPF until its length is in */
+static void a7139_ext_rx_setup(struct rf_dev *dev)
+{
+    dev->rx_pos = 0;
+    dev->rx_air = 0;
+    dev->tx_pos = 0;
+    dev->tx_air = 0;
+
+    a7139_write_page_a(dev, FIFO_PAGEA, rf_reg_cfg_page_a[FIFO_PAGEA]);
+    a7139_write_page_a(dev, GIO_PAGEA, A7139_GIO_FPF);
+    a7139_write_reg(dev, PIN_REG, rf_reg_cfg[PIN_REG] | A7139_PIN_INFS);
+    a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
+}
+
+/*****
+ ** Wake-on-Radio
+ *****/
+static const struct {
+    uint16_t gio;                   /* GIO1 signal that ends a wake-up */
+    uint16_t wor2;                  /* RC OSC and WOR trigger */
+} a7139_wor_regs[A7139_WOR_MAX] = {
+    [A7139_WOR_PREAMBLE]    = { 0x004D, 0x0030 },   // GIO1=PMDO, WOR by preamble
+    [A7139_WOR_SYNC]        = { 0x0045, 0x0010 },   // GIO1=FSYNC, WOR by sync
+    [A7139_WOR_CARRIER]     = { 0x0049, 0x0410 },   // GIO1=CD, WOR by carrier
+};
+
+static void a7139_arssi_update(struct rf_dev *dev);
+
+static uint16_t a7139_ack_reg(const A7139_ACK_CFG *cfg)
+{
+    uint16_t ack = 0;
+
+    /* resend waits for the ACK, so it needs EAK as well */
+    if (cfg->auto_ack || cfg->auto_resend) {
+        ack |= A7139_ACK_EAK;
+    }
+    if (cfg->auto_resend) {
+        ack |= A7139_ACK_EAR | (cfg->retries << A7139_ACK_ARC_SHIFT);
+    }
+
+    return ack;
+}
+
+/* VCB with the manual VCO current of a calibrated channel, the default otherwise */
+static uint16_t a7139_vcb_reg(struct rf_dev *dev, uint8_t ch)
+{
+    if (ch >= A7139_CH_CAL_SLOTS || !dev->ch_cal[ch].valid) {
+        return rf_reg_cfg_page_a[VCB_PAGEA];
+    }
+
+    return (rf_reg_cfg_page_a[VCB_PAGEA] & ~A7139_VCB_VCOC_MASK) | A7139_VCB_MVCS | dev->ch_cal[ch].vcb;
+}
+
+static uint32_t a7139_wor_duty_ppm(const A7139_WOR_CFG *cfg)
+{
+    uint64_t rx_us, sleep_us;
+
+    if (cfg->mode == A7139_WOR_OFF) {
+        return 1000000;
+    }
+
+    rx_us = (cfg->rx_win + 1) * 244;
+    sleep_us = (cfg->sleep + 1) * 7813;     // 1/128 s
+
+    return div_u64(rx_us * 1000000, rx_us + sleep_us);
+}
+
+/* the chip sleeps and opens rx windows by itself until GIO1 reports a wake-up */
+static void a7139_wor_arm(struct rf_dev *dev)
+{
+    const A7139_WOR_CFG *cfg = &dev->wor_cfg;
+
+    a7139_write_page_a(dev, GIO_PAGEA, a7139_wor_regs[cfg->mode].gio);
+    a7139_write_page_a(dev, WOR1_PAGEA, (cfg->rx_win << 10) | cfg->sleep);
+    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA] | a7139_wor_regs[cfg->mode].wor2);
+
+    if (cfg->mode == A7139_WOR_CARRIER) {
+        a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG] | 0x8096);                    // ARSSI=1, RTH=150
+        a7139_write_page_a(dev, RFI_PAGEA, rf_reg_cfg_page_a[RFI_PAGEA] | 0x6000);     // RSSI plus in-band carrier detect
+        a7139_write_page_b(dev, ACK_PAGEB, a7139_ack_reg(&dev->ack_cfg) | 0x0200);     // CDRS=[01]
+        a7139_write_page_a(dev, VCB_PAGEA, a7139_vcb_reg(dev, dev->rf_freq_ch) | 0x4000);  // CDTM=[01]
+    }
+
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | A7139_MODE_WORE);
+    dev->wor_armed = 1;
+}
+
+static void a7139_wor_disarm(struct rf_dev *dev)
+{
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG]);
+    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA]);
+    a7139_write_page_a(dev, GIO_PAGEA, rf_reg_cfg_page_a[GIO_PAGEA]);
+
+    if (dev->wor_cfg.mode == A7139_WOR_CARRIER) {
+        a7139_arssi_update(dev);
+        a7139_write_page_a(dev, RFI_PAGEA, rf_reg_cfg_page_a[RFI_PAGEA]);
+        a7139_write_page_b(dev, ACK_PAGEB, a7139_ack_reg(&dev->ack_cfg));
+        a7139_write_page_a(dev, VCB_PAGEA, a7139_vcb_reg(dev, dev->rf_freq_ch));
+    }
+
+    dev->wor_armed = 0;
+}
+
+/************************************************************************
+ **  WriteID
+ ************************************************************************/
+static int a7139_write_id(struct rf_dev *dev, uint8_t *id)
+{
+    uint8_t i;
+    uint8_t tmp[RF_IDSIZE];
+    int ret = 0;
+
+    for (i = 0; i < RF_IDSIZE; i++) {
+        dev->rf_id[i] = id[i];
+    }
+
+    dev->bus->write(dev, CMD_ID_W, dev->rf_id, RF_IDSIZE);
+    dev->bus->read(dev, CMD_ID_R, tmp, RF_IDSIZE);
+
+    for (i = 0; i < RF_IDSIZE; i++) {
+        ret += (tmp[i] == dev->rf_id[i] ? 0 : -1);
+    }
+    dev->id_valid = !ret;
+
+    return ret;
+}
+
+/************************************************************************
+ **  ReadID
+ ************************************************************************/
+static int a7139_read_id(struct rf_dev *dev, uint8_t *id)
+{
+    uint8_t i;
+    int ret = 0;
+
+    /* verified by a7139_write_id and untouched since */
+    if (dev->id_valid) {
+        memcpy(id, dev->rf_id, RF_IDSIZE);
+        dev->reg_saved++;
+        return 0;
+    }
+
+    dev->bus->read(dev, CMD_ID_R, id, RF_IDSIZE);
+
+    for (i = 0; i < RF_IDSIZE; i++) {
+        ret += (id[i] == dev->rf_id[i] ? 0 : -1);
+    }
+
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  : ģʽл
+//  : 
+// ز : 
+// ˵     :
+////////////////////////////////////////////////////////////////////////////////
+static void a7139_mode_switch(struct rf_dev *dev, A7139_MODE mode)
+{
+//    unsigned long flags;
+
+//    local_irq_save(flags);
+    if (dev->irq > 0) {
+        disable_irq_nosync(dev->irq);
+    }
+
+    if (dev->wor_armed) {
+        a7139_wor_disarm(dev);
+    }
+    dev->stats.mode_switches++;
+
+    switch (mode)
+    {
+        case A7139_MODE_SLEEP:
+            dev->rf_currmode = A7139_MODE_SLEEP;
+            a7139_send_ctrl(dev, CMD_SLEEP_MODE);
+            break;
+
+        case A7139_MODE_IDLE:
+            dev->rf_currmode = A7139_MODE_IDLE;
+            a7139_send_ctrl(dev, CMD_IDLE_MODE);
+            break;
+
+        case A7139_MODE_STANDBY:
+            dev->rf_currmode = A7139_MODE_STANDBY;
+            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
+            break;
+
+        case A7139_MODE_PLL:
+            dev->rf_currmode = A7139_MODE_PLL;
+            a7139_send_ctrl(dev, CMD_PLL_MODE);
+            break;
+
+        case A7139_MODE_RX:
+            dev->rf_currmode = A7139_MODE_RX;
+            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
+            if (a7139_frame_ext(dev)) {
+                a7139_ext_rx_setup(dev);
+            }
+            if ( in_interrupt() == 0 && current != dev->irq_task)
+            {
+                usleep_range(1000, 2000);
+            }
+            if (dev->wor_cfg.mode != A7139_WOR_OFF) {
+                a7139_wor_arm(dev);
+            } else {
+                a7139_send_ctrl(dev, CMD_RX_MODE);
+            }
+            dev->rx_since = ktime_get();
+            break;
+
+        case A7139_MODE_RXING:
+            dev->rf_currmode = A7139_MODE_RXING;
+            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
+            break;
+
+        case A7139_MODE_TX:
+            dev->rf_currmode = A7139_MODE_TX;
+            a7139_send_ctrl(dev, CMD_TX_MODE);
+            break;
+
+        case A7139_MODE_TXING:
+            dev->rf_currmode = A7139_MODE_TXING;
+            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
+            break;
+
+        case A7139_MODE_DEEPSLEEPT:
+            dev->rf_currmode = A7139_MODE_DEEPSLEEPT;
+            a7139_send_ctrl(dev, CMD_DEEP_SLEEP_T);
+            break;
+
+        case A7139_MODE_DEEPSLEEPP:
+            dev->rf_currmode = A7139_MODE_DEEPSLEEPP;
+            a7139_send_ctrl(dev, CMD_DEEP_SLEEP_P);
+            break;
+
+        default:
+            break;
+    }
+
+//    local_irq_restore(flags);
+    if (dev->irq > 0) {
+        enable_irq(dev->irq);
+    }
+
+    /*
+     * after enable_irq(), an edge latched while the irq was off and
+     * retriggered by the controller has taken the old generation
+     */
+    dev->mode_gen++;
+}
+
+/************************************************************************
+ **  DataRateSet
+ ************************************************************************/
+static int a7139_cal_if(struct rf_dev *dev);
+
+static void a7139_rate_regs(struct rf_dev *dev, A7139_RATE drate)
+{
+    const struct rf_rate_profile *p = &rate_profile_tab[drate];
+
+    a7139_write_reg(dev, SYSTEMCLOCK_REG, p->sysclk);
+    a7139_write_reg(dev, RX1_REG, p->rx1);
+    a7139_write_page_a(dev, TX1_PAGEA, p->tx1);
+    a7139_write_page_b(dev, IF1_PAGEB, p->if1);
+}
+
+/* called in standby, the whole profile is in place before rx or tx resumes */
+static int a7139_datarate_set(struct rf_dev *dev, A7139_RATE drate)
+{
+    if (drate >= A7139_RATE_MAX) {
+        return -EINVAL;
+    }
+
+    a7139_rate_regs(dev, drate);
+    dev->rf_datarate = drate;
+
+    /* the IF filter is calibrated for the clock and bandwidth */
+    return a7139_cal_if(dev);
+}
+
+/************************************************************************
+ **  FreqSet
+ ************************************************************************/
+static int a7139_ch_cal(struct rf_dev *dev, uint8_t ch);
+static void a7139_ch_cal_store(struct rf_dev *dev, uint8_t ch);
+static void a7139_ch_cal_restore(struct rf_dev *dev, uint8_t ch);
+
+/* PLL1/PLL2 for hz, FP rounded to the nearest 195Hz step */
+static int a7139_pll_calc(uint32_t hz, uint16_t *pll1, uint16_t *pll2)
+{
+    uint32_t ip;
+    uint64_t fp;
+
+    if (hz < A7139_FREQ_MIN_HZ || hz > A7139_FREQ_MAX_HZ) {
+        return -EINVAL;
+    }
+
+    ip = hz / A7139_XTAL_HZ;
+    fp = div_u64(((uint64_t)(hz % A7139_XTAL_HZ) << 16) + A7139_XTAL_HZ / 2, A7139_XTAL_HZ);
+    if (fp > 0xFFFF) {
+        ip++;
+        fp = 0;
+    }
+
+    *pll1 = (rf_reg_cfg[PLL1_REG] & ~A7139_PLL1_IP_MASK) | ip;
+    *pll2 = (uint16_t)fp;
+
+    return 0;
+}
+
+static uint32_t a7139_pll_hz(uint16_t pll1, uint16_t pll2)
+{
+    return (pll1 & A7139_PLL1_IP_MASK) * A7139_XTAL_HZ +
+        (uint32_t)(((uint64_t)pll2 * A7139_XTAL_HZ + 0x8000) >> 16);
+}
+
+/* write the PLL words, slot keys the VCO calibration cache */
+static int a7139_pll_tune(struct rf_dev *dev, uint8_t slot, uint16_t pll1, uint16_t pll2)
+{
+    a7139_write_reg(dev, PLL1_REG, pll1);       // setting PLL1
+    a7139_write_reg(dev, PLL2_REG, pll2);       // setting PLL2
+
+    /* a known channel only needs its VCO band and current back */
+    if (dev->ch_cal[slot].valid) {
+        a7139_ch_cal_restore(dev, slot);
+        return 0;
+    }
+
+    return a7139_ch_cal(dev, slot);
+}
+
+/* tune the PLL to a table channel, calibrating it on first use */
+static int a7139_pll_set(struct rf_dev *dev, uint8_t ch)
+{
+    if (ch >= RF_FREQ_TAB_MAXSIZE) {
+        return -EINVAL;
+    }
+
+    return a7139_pll_tune(dev, ch, freq_cal_tab[2 * ch], freq_cal_tab[2 * ch + 1]);
+}
+
+static int a7139_plan_words(const A7139_CH_CFG *cfg, uint8_t ch, uint16_t *pll1, uint16_t *pll2)
+{
+    if (ch >= cfg->channels) {
+        return -EINVAL;
+    }
+
+    return a7139_pll_calc(cfg->base_hz + ch * cfg->spacing_hz, pll1, pll2);
+}
+
+/* synthesized frequency of the current channel */
+static uint32_t a7139_ch_hz(struct rf_dev *dev)
+{
+    uint8_t ch = dev->rf_freq_ch;
+    uint16_t pll1, pll2;
+
+    switch (dev->ch_cfg.mode) {
+        case A7139_CH_OFFSET:
+            ch = dev->ch_cfg.base;
+            /* fall through */
+        case A7139_CH_TABLE:
+        default:
+            pll1 = freq_cal_tab[2 * ch];
+            pll2 = freq_cal_tab[2 * ch + 1];
+            break;
+
+        case A7139_CH_PLAN:
+            if (a7139_plan_words(&dev->ch_cfg, ch, &pll1, &pll2)) {
+                return 0;
+            }
+            break;
+    }
+
+    if (dev->ch_cfg.mode == A7139_CH_OFFSET) {
+        return a7139_pll_hz(pll1, pll2) + dev->rf_freq_ch * dev->ch_cfg.spacing_hz;
+    }
+
+    return a7139_pll_hz(pll1, pll2);
+}
+
+static int a7139_freq_set(struct rf_dev *dev, uint8_t ch)
+{
+    uint16_t pll1, pll2;
+    uint32_t offset;
+    int ret;
+
+    if (dev->ch_cfg.mode == A7139_CH_OFFSET) {
+        offset = (uint32_t)ch * dev->ch_cfg.spacing_hz;
+        if (offset >= A7139_CH_SPAN_HZ) {
+            return -EINVAL;
+        }
+
+        /* the PLL and its calibration stay, only the offset moves */
+        a7139_write_page_b(dev, IF2_PAGEB, offset / A7139_CH_STEP_HZ);
+    } else if (dev->ch_cfg.mode == A7139_CH_PLAN) {
+        ret = a7139_plan_words(&dev->ch_cfg, ch, &pll1, &pll2);
+        if (ret) {
+            return ret;
+        }
+
+        a7139_write_page_b(dev, IF2_PAGEB, rf_reg_cfg_page_b[IF2_PAGEB]);
+        ret = a7139_pll_tune(dev, ch, pll1, pll2);
+        if (ret) {
+            return ret;
+        }
+    } else {
+        a7139_write_page_b(dev, IF2_PAGEB, rf_reg_cfg_page_b[IF2_PAGEB]);
+        ret = a7139_pll_set(dev, ch);
+        if (ret) {
+            return ret;
+        }
+    }
+    dev->rf_freq_ch = ch;
+
+    return 0;
+}
+
+/* back to the channel in use after a chip reset */
+static int a7139_ch_restore(struct rf_dev *dev)
+{
+    int ret;
+
+    if (dev->ch_cfg.mode == A7139_CH_OFFSET) {
+        ret = a7139_pll_set(dev, dev->ch_cfg.base);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return a7139_freq_set(dev, dev->rf_freq_ch);
+}
+
+static int a7139_ch_mode_set(struct rf_dev *dev, const A7139_CH_CFG *cfg)
+{
+    A7139_CH_CFG old = dev->ch_cfg;
+    uint16_t pll1, pll2;
+    bool cal_reset;
+    int ret;
+
+    if (cfg->mode >= A7139_CH_MAX) {
+        return -EINVAL;
+    }
+
+    if (cfg->mode == A7139_CH_PLAN) {
+        if (!cfg->channels || cfg->channels > A7139_PLAN_MAX_CHANNELS ||
+                cfg->base >= cfg->channels ||
+                (cfg->channels > 1 && !cfg->spacing_hz) ||
+                cfg->spacing_hz > (A7139_FREQ_MAX_HZ - A7139_FREQ_MIN_HZ)) {
+            return -EINVAL;
+        }
+
+        /* both ends of the plan inside the band */
+        ret = a7139_plan_words(cfg, 0, &pll1, &pll2);
+        if (!ret) {
+            ret = a7139_plan_words(cfg, cfg->channels - 1, &pll1, &pll2);
+        }
+        if (ret) {
+            return ret;
+        }
+    } else if (cfg->base >= RF_FREQ_TAB_MAXSIZE) {
+        return -EINVAL;
+    }
+
+    if (cfg->mode == A7139_CH_OFFSET && (!cfg->spacing_hz ||
+            cfg->spacing_hz % A7139_CH_STEP_HZ || cfg->spacing_hz >= A7139_CH_SPAN_HZ)) {
+        return -EINVAL;
+    }
+
+    /* plan channels share the cache slots of the table channels */
+    cal_reset = cfg->mode == A7139_CH_PLAN || old.mode == A7139_CH_PLAN;
+    if (cal_reset) {
+        memset(dev->ch_cal, 0, sizeof(dev->ch_cal));
+    }
+
+    dev->ch_cfg = *cfg;
+    if (cfg->mode == A7139_CH_OFFSET) {
+        ret = a7139_pll_set(dev, cfg->base);
+        if (!ret) {
+            ret = a7139_freq_set(dev, 0);
+        }
+    } else {
+        ret = a7139_freq_set(dev, cfg->base);
+    }
+
+    /* the old mode stays, rf_freq_ch was not touched */
+    if (ret) {
+        dev->ch_cfg = old;
+        if (cal_reset) {
+            memset(dev->ch_cal, 0, sizeof(dev->ch_cal));
+        }
+        if (a7139_ch_restore(dev)) {
+            printk(KERN_ERR "%s:a7139 channel restore error!\n", dev->name_alias);
+        }
+    }
+
+    return ret;
+}
+
+/*********************************************************************
+ ** A7139_Cal
+ *********************************************************************/
+static const char * const a7139_cal_names[A7139_CAL_STAGES] = {
+    [A7139_CAL_IF]      = "IF filter/VCO current",
+    [A7139_CAL_RSSI]    = "RSSI",
+    [A7139_CAL_VCO]     = "VCO band",
+    [A7139_CAL_RCOSC]   = "RC oscillator",
+};
+
+/* sleep until the self-clearing bits in mask are down, or the deadline passes */
+static int a7139_wait_clear(struct rf_dev *dev, uint16_t (*read)(struct rf_dev *, uint8_t),
+        uint8_t address, uint16_t mask)
+{
+    s64 deadline = ktime_to_ns(ktime_add_us(ktime_get(), A7139_CAL_TIMEOUT_US));
+
+    while (read(dev, address) & mask) {
+        if (ktime_to_ns(ktime_get()) > deadline) {
+            /* may have been preempted past the deadline, look once more */
+            return (read(dev, address) & mask) ? -ETIMEDOUT : 0;
+        }
+        usleep_range(A7139_CAL_POLL_MIN_US, A7139_CAL_POLL_MAX_US);
+    }
+
+    return 0;
+}
+
+static void a7139_cal_time(struct rf_dev *dev, A7139_CAL_STAGE stage, ktime_t start)
+{
+    dev->cal_stat.stage_us[stage] = ktime_us_delta(ktime_get(), start);
+}
+
+static int a7139_cal_fail(struct rf_dev *dev, A7139_CAL_STAGE stage, int err)
+{
+    dev->cal_stat.err = err;
+    dev->cal_stat.failed_stage = stage;
+    dev->stats.cal_failures++;
+
+    printk(KERN_ERR "%s: %s calibration %s\n", dev->name_alias, a7139_cal_names[stage],
+            err == -ETIMEDOUT ? "timeout" : "failed");
+
+    return err;
+}
+
+static int a7139_cal_if(struct rf_dev *dev)
+{
+    uint8_t fbcf; // IF Filter
+    uint8_t vccf; // VCO Current
+    uint16_t tmp;
+    ktime_t start;
+    int ret;
+
+    // IF calibration procedure @STB state
+    start = ktime_get();
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0802);   // IF Filter & VCO Current Calibration
+    ret = a7139_wait_clear(dev, a7139_read_reg, MODE_REG, 0x0802);
+    a7139_cal_time(dev, A7139_CAL_IF, start);
+    if (ret) {
+        return a7139_cal_fail(dev, A7139_CAL_IF, ret);
+    }
+
+    // for check(IF Filter)
+    tmp = a7139_read_reg(dev, CALIBRATION_REG);
+    fbcf = (tmp >> 4) & 0x01;
+    if (fbcf) {
+        return a7139_cal_fail(dev, A7139_CAL_IF, -EIO);
+    }
+
+    // for check(VCO Current)
+    tmp = a7139_read_page_a(dev, VCB_PAGEA);
+    vccf = (tmp >> 4) & 0x01;
+    if (vccf) {
+        return a7139_cal_fail(dev, A7139_CAL_IF, -EIO);
+    }
+
+    return 0;
+}
+
+static int a7139_cal(struct rf_dev *dev)
+{
+    uint8_t vbcf; // VCO Band
+    uint16_t tmp;
+    ktime_t start;
+    int ret;
+
+    dev->cal_stat.err = 0;
+
+    ret = a7139_cal_if(dev);
+    if (ret) {
+        return ret;
+    }
+
+    // RSSI Calibration procedure @STB state
+    start = ktime_get();
+    a7139_write_reg(dev, ADC_REG, 0x4C00);           // set ADC average=64
+    a7139_write_page_a(dev, WOR2_PAGEA, 0xF800);     // set RSSC_D=40us and RS_DLY=80us
+    a7139_write_page_a(dev, TX1_PAGEA, rate_profile_tab[dev->rf_datarate].tx1 | 0xE000);   // set RC_DLY=1.5ms
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x1000);              // RSSI Calibration
+
+    ret = a7139_wait_clear(dev, a7139_read_reg, MODE_REG, 0x1000);
+
+    a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG]);
+    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA]);
+    a7139_write_page_a(dev, TX1_PAGEA, rate_profile_tab[dev->rf_datarate].tx1);
+    a7139_cal_time(dev, A7139_CAL_RSSI, start);
+    if (ret) {
+        return a7139_cal_fail(dev, A7139_CAL_RSSI, ret);
+    }
+
+    // VCO calibration procedure @STB state
+    start = ktime_get();
+    a7139_write_reg(dev, PLL1_REG, freq_cal_tab[0]);
+    a7139_write_reg(dev, PLL2_REG, freq_cal_tab[1]);
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0004);              // VCO Band Calibration
+    ret = a7139_wait_clear(dev, a7139_read_reg, MODE_REG, 0x0004);
+    a7139_cal_time(dev, A7139_CAL_VCO, start);
+    if (ret) {
+        return a7139_cal_fail(dev, A7139_CAL_VCO, ret);
+    }
+
+    // for check(VCO Band)
+    tmp = a7139_read_reg(dev, CALIBRATION_REG);
+    vbcf = (tmp >> 8) & 0x01;
+    if (vbcf) {
+        return a7139_cal_fail(dev, A7139_CAL_VCO, -EIO);
+    }
+
+    /* the band above is for freq_cal_tab[0], slot 0 is a plan channel in A7139_CH_PLAN */
+    memset(dev->ch_cal, 0, sizeof(dev->ch_cal));
+    if (dev->ch_cfg.mode != A7139_CH_PLAN) {
+        a7139_ch_cal_store(dev, 0);
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+ ** per channel VCO calibration
+ *********************************************************************/
+static void a7139_ch_cal_store(struct rf_dev *dev, uint8_t ch)
+{
+    dev->ch_cal[ch].vb = A7139_CALREG_VB(a7139_read_reg(dev, CALIBRATION_REG));
+    dev->ch_cal[ch].vcb = A7139_VCB_VCB(a7139_read_page_a(dev, VCB_PAGEA));
+    dev->ch_cal[ch].valid = 1;
+}
+
+static void a7139_ch_cal_restore(struct rf_dev *dev, uint8_t ch)
+{
+    a7139_write_reg(dev, CALIBRATION_REG, (rf_reg_cfg[CALIBRATION_REG] & ~A7139_CALREG_MVB_MASK) |
+            A7139_CALREG_MVBS | (dev->ch_cal[ch].vb << 5));
+    a7139_write_page_a(dev, VCB_PAGEA, a7139_vcb_reg(dev, ch));
+}
+
+/* VCO current and band calibration at the channel already set in PLL1/PLL2, @STB state */
+static int a7139_ch_cal(struct rf_dev *dev, uint8_t ch)
+{
+    ktime_t start = ktime_get();
+    int ret;
+
+    /* back to automatic, the chip calibrates over a manual selection otherwise */
+    a7139_write_reg(dev, CALIBRATION_REG, rf_reg_cfg[CALIBRATION_REG]);
+    a7139_write_page_a(dev, VCB_PAGEA, rf_reg_cfg_page_a[VCB_PAGEA]);
+
+    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0800);              // VCO Current Calibration
+    ret = a7139_wait_clear(dev, a7139_read_reg, MODE_REG, 0x0800);
+    if (!ret && ((a7139_read_page_a(dev, VCB_PAGEA) >> 4) & 0x01)) {
+        ret = -EIO;
+    }
+
+    if (!ret) {
+        a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0004);          // VCO Band Calibration
+        ret = a7139_wait_clear(dev, a7139_read_reg, MODE_REG, 0x0004);
+    }
+    if (!ret && ((a7139_read_reg(dev, CALIBRATION_REG) >> 8) & 0x01)) {
+        ret = -EIO;
+    }
+
+    a7139_cal_time(dev, A7139_CAL_VCO, start);
+    if (ret) {
+        return a7139_cal_fail(dev, A7139_CAL_VCO, ret);
+    }
+
+    a7139_ch_cal_store(dev, ch);
+
+    return 0;
+}
+
+//**********************************************************************************
+//  : RFʼ
+//  : 
+// ز : 
+// ˵     :
+//**********************************************************************************
+static int __a7139_chip_init(struct rf_dev *dev)
+{
+    int ret;
+
+    // init io pin
+    if (!dev->spi) {
+        gpio_pin_mo_h(dev->pin.scs);
+        gpio_pin_mo_l(dev->pin.sck);
+        gpio_pin_mo_h(dev->pin.sdio);
+    }
+    gpio_pin_mi(dev->pin.gio1);
+
+    a7139_send_ctrl(dev, CMD_RF_RST);   // reset  chip
+
+    spi_defdelay();
+
+    if (a7139_config(dev)) {            // config A7139 chip
+        printk(KERN_ERR "a7139_config error\n");
+        return -EIO;
+    }
+
+    /* the FIFO extension frames carry their own crc */
+    if (a7139_frame_ext(dev)) {
+        dev->rf_code &= ~A7139_CODE_CRCS;
+    }
+    a7139_write_page_a(dev, CODE_PAGEA, dev->rf_code);
+    a7139_write_page_b(dev, TX2_PAGEB, dev->rf_tx2);
+
+    spi_defdelay();                     // for crystal stabilized
+
+    if (a7139_write_id(dev, dev->rf_id)) {  // write ID code
+        printk(KERN_ERR "a7139_write_id error\n");
+        return -EIO;
+    }
+
+    /* before the calibration, the IF filter depends on it */
+    a7139_rate_regs(dev, dev->rf_datarate);
+
+    ret = a7139_cal(dev);               // IF and VCO calibration
+    if (ret) {
+        printk(KERN_ERR "a7139_cal error\n");
+        return ret;
+    }
+
+    spi_defdelay();
+
+    a7139_ch_restore(dev);
+
+    return 0;
+}
+
+static int a7139_chip_init(struct rf_dev *dev)
+{
+    ktime_t start = ktime_get();
+    int ret;
+
+    ret = __a7139_chip_init(dev);
+    dev->cal_stat.init_us = ktime_us_delta(ktime_get(), start);
+
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  : 
+//  : uint8_t *txBuffer:ݴ洢׵ַ,
+//            uint8_t sizeݳ
 // ز : 
 // ˵     :
 ////////////////////////////////////////////////////////////////////////////////
-static void a7139_mode_switch(struct rf_dev *dev, A7139_MODE mode)
+static void a7139_send_packet(struct rf_dev *dev, uint8_t *txBuffer, uint8_t size)
 {
-//    unsigned long flags;
+    //a7139_mode_switch(dev, A7139_MODE_STANDBY);     // enter standby mode
+
+    a7139_send_ctrl(dev, CMD_TFR);                  // TX FIFO address pointer reset
+
+    dev->bus->write(dev, CMD_DATAW, txBuffer, size);    // TX FIFO write command
+
+    a7139_mode_switch(dev, A7139_MODE_TX);
+}
+
+/*
+ * Send the tx_len byte payload at txbuf + A7139_EXT_HLEN. The first
+ * segment is loaded here, the rest by a7139_ext_tx_chunk() on FPF.
+ */
+static void a7139_ext_send(struct rf_dev *dev)
+{
+    uint8_t *buf = dev->txbuf;
+    unsigned int len = dev->tx_len;
+    unsigned int end = A7139_EXT_HLEN + len;
+    uint16_t crc;
+
+    buf[0] = len & 0xFF;
+    buf[1] = len >> 8;
+    crc = crc_ccitt(0xFFFF, buf, end);
+    buf[end++] = crc & 0xFF;
+    buf[end++] = crc >> 8;
+
+    dev->tx_air = a7139_ext_air_len(len);
+    memset(buf + end, 0, dev->tx_air - end);
+
+    a7139_send_ctrl(dev, CMD_TFR);      // TX FIFO address pointer reset
+
+    if (dev->tx_air == RF_BUFSIZE) {
+        /* fits the FIFO, a plain frame ended by WTR */
+        a7139_write_reg(dev, PIN_REG, rf_reg_cfg[PIN_REG]);
+        a7139_write_page_a(dev, FIFO_PAGEA, rf_reg_cfg_page_a[FIFO_PAGEA]);
+        a7139_write_page_a(dev, GIO_PAGEA, rf_reg_cfg_page_a[GIO_PAGEA]);
+    } else {
+        /* FEP is the last segment, the ones before go with INFS=1 */
+        a7139_write_page_a(dev, FIFO_PAGEA, dev->tx_air % RF_BUFSIZE - 1);
+        a7139_write_page_a(dev, GIO_PAGEA, A7139_GIO_FPF);
+        a7139_write_reg(dev, PIN_REG, rf_reg_cfg[PIN_REG] | A7139_PIN_INFS);
+    }
+
+    dev->bus->write(dev, CMD_DATAW, buf, RF_BUFSIZE);
+    dev->tx_pos = RF_BUFSIZE;
+
+    a7139_mode_switch(dev, A7139_MODE_TX);
+}
+
+static int a7139_ack_set(struct rf_dev *dev, const A7139_ACK_CFG *cfg)
+{
+    if (cfg->retries > A7139_ACK_MAX_RETRIES) {
+        return -EINVAL;
+    }
+
+    /* streamed frames can not be resent from the FIFO, nor ACKed without a fixed length */
+    if ((cfg->auto_ack || cfg->auto_resend) && a7139_frame_ext(dev)) {
+        return -EINVAL;
+    }
+
+    a7139_write_page_b(dev, ACK_PAGEB, a7139_ack_reg(cfg));
+    a7139_write_page_b(dev, ART_PAGEB, cfg->ard);
+    dev->ack_cfg = *cfg;
+
+    return 0;
+}
+
+/*
+ * tx done with auto resend, VPOAK tells if an ACK came back before the
+ * retries ran out. GIO1 is turned to VPOAK just to sample it; with an
+ * ACK standby drops VPOAK and GIO1 falls, that edge is made stale like
+ * the ones of a mode switch.
+ */
+static void a7139_ack_result(struct rf_dev *dev)
+{
+    A7139_TX_RES res;
 
-//    local_irq_save(flags);
     if (dev->irq > 0) {
         disable_irq_nosync(dev->irq);
     }
 
-    switch (mode)
+    a7139_write_page_a(dev, GIO_PAGEA, A7139_GIO_VPOAK);
+    res.acked = !!gpio_pin_in(dev->pin.gio1);
+    a7139_send_ctrl(dev, CMD_STANDBY_MODE);
+    a7139_write_page_a(dev, GIO_PAGEA, rf_reg_cfg_page_a[GIO_PAGEA]);
+
+    if (dev->irq > 0) {
+        enable_irq(dev->irq);
+    }
+    dev->mode_gen++;
+
+    res.seq = ++dev->tx_seq;
+    if (res.acked) {
+        dev->tx_acked++;
+    } else {
+        dev->tx_noack++;
+    }
+
+    /* nobody reads them, keep the newest */
+    if (kfifo_is_full(&dev->tx_res)) {
+        kfifo_skip(&dev->tx_res);
+    }
+    kfifo_put(&dev->tx_res, &res);
+
+    wake_up_interruptible(&dev->w_wait);
+}
+
+/* FPF while sending, refill the segment the chip just moved out */
+static void a7139_ext_tx_chunk(struct rf_dev *dev)
+{
+    unsigned int remain = dev->tx_air - dev->tx_pos;
+
+    if (remain > RF_BUFSIZE) {
+        dev->bus->write(dev, CMD_DATAW, dev->txbuf + dev->tx_pos, RF_BUFSIZE);
+        dev->tx_pos += RF_BUFSIZE;
+    } else {
+        /* last segment, INFS=0 ends the frame at FEP and WTR reports tx done */
+        dev->bus->write(dev, CMD_DATAW, dev->txbuf + dev->tx_pos, remain);
+        a7139_write_reg(dev, PIN_REG, rf_reg_cfg[PIN_REG]);
+        a7139_write_page_a(dev, GIO_PAGEA, rf_reg_cfg_page_a[GIO_PAGEA]);
+        dev->tx_pos = dev->tx_air;
+    }
+}
+
+///*********************************************************************
+//** A7139_WriteFIFO
+//*********************************************************************/
+//void LSD_RF_WriteFIFO(void)
+//{
+//    uint8_t i;
+//
+//    a7139_send_ctrl(CMD_TFR);        //TX FIFO address pointer reset
+//    spi_scs_l;
+//    a7139_byte_send(CMD_DATAW);    //TX FIFO write command
+//    for(i=0; i <64; i++)
+//    a7139_byte_send(PN9_Tab[i]);
+//    spi_scs_h;
+//}
+
+////////////////////////////////////////////////////////////////////////////////
+//  : ݰ
+//  : uint8_t *buf,ݴ洢׵ַ uint8_t len ݳ
+// ز : 
+// ˵     :
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t a7139_receive_packet(struct rf_dev *dev, uint8_t *buf, uint8_t len)
+{
+    a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
+
+    dev->bus->read(dev, CMD_DATAR, buf, len);   // RX FIFO read command
+    /*
+    for (i = 0; i < 64; i++)
     {
-        case A7139_MODE_SLEEP:
-            dev->rf_currmode = A7139_MODE_SLEEP;
-            a7139_send_ctrl(dev, CMD_SLEEP_MODE);
-            break;
+        recv = tmpbuf[i];
+        tmp = recv ^ PN9_Tab[i];
+        if (tmp != 0)
+        {
+            Err_ByteCnt++;
+            Err_BitCnt += (bit_count_tab[tmp>>4] + bit_count_tab[tmp & 0x0F]);
+        }
+    }
+    */
 
-        case A7139_MODE_IDLE:
-            dev->rf_currmode = A7139_MODE_IDLE;
-            a7139_send_ctrl(dev, CMD_IDLE_MODE);
-            break;
+    return len;
+}
 
-        case A7139_MODE_STANDBY:
-            dev->rf_currmode = A7139_MODE_STANDBY;
-            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
-            break;
 
-        case A7139_MODE_PLL:
-            dev->rf_currmode = A7139_MODE_PLL;
-            a7139_send_ctrl(dev, CMD_PLL_MODE);
-            break;
+/*********************************************************************
+ ** RC Oscillator Calibration
+ *********************************************************************/
+static int a7139_rcosc_cal(struct rf_dev *dev)
+{
+    ktime_t start = ktime_get();
+    uint16_t tmp;
+    int ret;
+    int i;
 
-        case A7139_MODE_RX:
-            dev->rf_currmode = A7139_MODE_RX;
-            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
-            if ( in_interrupt() == 0)
-            {
-                spi_mdelay(1);
-            }
-            a7139_send_ctrl(dev, CMD_RX_MODE);
-            break;
+    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA] | 0x0010);        //enable RC OSC
 
-        case A7139_MODE_RXING:
-            dev->rf_currmode = A7139_MODE_RXING;
-            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
-            break;
+    for (i = 0; i < A7139_RCOSC_CAL_TRIES; i++) {
+        a7139_write_page_a(dev, WCAL_PAGEA, rf_reg_cfg_page_a[WCAL_PAGEA] | 0x0001);    //set ENCAL=1 to start RC OSC CAL
+        ret = a7139_wait_clear(dev, a7139_read_page_a, WCAL_PAGEA, 0x0001);
+        if (ret) {
+            a7139_cal_time(dev, A7139_CAL_RCOSC, start);
+            return a7139_cal_fail(dev, A7139_CAL_RCOSC, ret);
+        }
 
-        case A7139_MODE_TX:
-            dev->rf_currmode = A7139_MODE_TX;
-            a7139_send_ctrl(dev, CMD_TX_MODE);
-            break;
+        tmp = (a7139_read_page_a(dev, WCAL_PAGEA) & 0x03FF);         // read NUMLH[8:0]
+        tmp >>= 1;
+        if ((tmp > 186) && (tmp < 198))                         // NUMLH[8:0]~192
+        {
+            a7139_cal_time(dev, A7139_CAL_RCOSC, start);
+            return 0;
+        }
+    }
 
-        case A7139_MODE_TXING:
-            dev->rf_currmode = A7139_MODE_TXING;
-            a7139_send_ctrl(dev, CMD_STANDBY_MODE);
-            break;
+    a7139_cal_time(dev, A7139_CAL_RCOSC, start);
 
-        case A7139_MODE_DEEPSLEEPT:
-            dev->rf_currmode = A7139_MODE_DEEPSLEEPT;
-            a7139_send_ctrl(dev, CMD_DEEP_SLEEP_T);
-            break;
+    return a7139_cal_fail(dev, A7139_CAL_RCOSC, -EIO);
+}
 
-        case A7139_MODE_DEEPSLEEPP:
-            dev->rf_currmode = A7139_MODE_DEEPSLEEPP;
-            a7139_send_ctrl(dev, CMD_DEEP_SLEEP_P);
-            break;
+static int a7139_pin_init(struct rf_dev *dev)
+{
+    int result;
 
-        default:
-            break;
+    result = gpio_request_one(dev->pin.gio1, GPIOF_IN, DEVICE_NAME);
+    if (result) {
+        return -EBUSY;
     }
 
-//    local_irq_restore(flags);
-    if (dev->irq > 0) {
-        enable_irq(dev->irq);
+    /* SCS/SCK/SDIO belong to the McSPI controller */
+    if (dev->spi_bus >= 0) {
+        result = a7139_spi_init(dev, dev->spi_bus, dev->spi_cs);
+        if (result) {
+            gpio_free(dev->pin.gio1);
+            return result;
+        }
+
+        return 0;
+    }
+
+    result = gpio_request_one(dev->pin.scs, GPIOF_OUT_INIT_HIGH, DEVICE_NAME);
+    if (result) {
+        goto err;
+    }
+    result = gpio_request_one(dev->pin.sck, GPIOF_OUT_INIT_LOW, DEVICE_NAME);
+    if (result) {
+        goto err;
+    }
+    result = gpio_request_one(dev->pin.sdio, GPIOF_IN, DEVICE_NAME);
+    if (result) {
+        goto err;
+    }
+
+    dev->bus = &a7139_gpio_ops;
+    if (gpio_mmio && !a7139_mmio_init(dev)) {
+        dev->bus = &a7139_mmio_ops;
+    }
+    a7139_sck_calibrate(dev);
+
+    return 0;
+
+err:
+    gpio_free(dev->pin.scs);
+    gpio_free(dev->pin.sck);
+    gpio_free(dev->pin.sdio);
+    gpio_free(dev->pin.gio1);
+
+    return -EBUSY;
+}
+
+static void a7139_pin_free(struct rf_dev *dev)
+{
+    if (dev->spi) {
+        a7139_spi_free(dev);
+    } else {
+        if (dev->gpio_base) {
+            iounmap(dev->gpio_base);
+            dev->gpio_base = NULL;
+        }
+        gpio_free(dev->pin.scs);
+        gpio_free(dev->pin.sck);
+        gpio_free(dev->pin.sdio);
     }
+    gpio_free(dev->pin.gio1);
 }
 
-/************************************************************************
- **  DataRateSet
- ************************************************************************/
-static int a7139_datarate_set(struct rf_dev *dev, A7139_RATE drate)
+/*****
+ ** mmap rings
+ *****/
+static inline A7139_SLOT *a7139_ring_slot(struct rf_dev *dev, unsigned int index)
 {
-    if (drate >= A7139_RATE_MAX) {
+    return (A7139_SLOT *)((uint8_t *)dev->ring + index * dev->ring_req.slot_size);
+}
+
+static inline A7139_SLOT *a7139_rx_slot(struct rf_dev *dev, unsigned int index)
+{
+    return a7139_ring_slot(dev, index);
+}
+
+static inline A7139_SLOT *a7139_tx_slot(struct rf_dev *dev, unsigned int index)
+{
+    return a7139_ring_slot(dev, dev->ring_req.rx_slots + index);
+}
+
+static void a7139_ring_flush(const void *addr, size_t len)
+{
+    unsigned long p = (unsigned long)addr & PAGE_MASK;
+
+    for (; p < (unsigned long)addr + len; p += PAGE_SIZE) {
+        flush_dcache_page(vmalloc_to_page((void *)p));
+    }
+}
+
+static uint32_t a7139_slot_status(A7139_SLOT *slot)
+{
+    uint32_t status;
+
+    a7139_ring_flush(&slot->status, sizeof(slot->status));
+    status = ACCESS_ONCE(slot->status);
+    smp_rmb();
+
+    return status;
+}
+
+static void a7139_slot_set_status(A7139_SLOT *slot, uint32_t status)
+{
+    smp_wmb();
+    slot->status = status;
+    a7139_ring_flush(&slot->status, sizeof(slot->status));
+}
+
+/* hand one received frame to user, -ENOSPC when the next slot is still user's */
+static int a7139_ring_rx(struct rf_dev *dev, const A7139_RX_HDR *hdr, const uint8_t *data)
+{
+    A7139_SLOT *slot;
+
+    if (!dev->ring_req.rx_slots ||
+            hdr->len > dev->ring_req.slot_size - sizeof(A7139_SLOT)) {
+        return -ENOSPC;
+    }
+
+    slot = a7139_rx_slot(dev, dev->ring_rx_head);
+    if (a7139_slot_status(slot) != A7139_SLOT_KERNEL) {
+        return -ENOSPC;
+    }
+
+    slot->hdr = *hdr;
+    memcpy(slot + 1, data, hdr->len);
+    a7139_ring_flush(slot, sizeof(*slot) + hdr->len);
+    a7139_slot_set_status(slot, A7139_SLOT_USER);
+
+    dev->ring_rx_head = (dev->ring_rx_head + 1) % dev->ring_req.rx_slots;
+
+    return 0;
+}
+
+static bool a7139_ring_tx_pending(struct rf_dev *dev)
+{
+    return dev->ring && dev->ring_req.tx_slots &&
+        a7139_slot_status(a7139_tx_slot(dev, dev->ring_tx_tail)) == A7139_SLOT_SEND_REQUEST;
+}
+
+/* take the next user filled tx slot into buf, returns its length or 0 */
+static unsigned int a7139_ring_tx(struct rf_dev *dev, uint8_t *buf, unsigned int size)
+{
+    A7139_SLOT *slot;
+    unsigned int len = 0;
+    unsigned int n;
+
+    /* empty slots are given back without being sent */
+    for (n = 0; n < dev->ring_req.tx_slots && !len && a7139_ring_tx_pending(dev); n++) {
+        slot = a7139_tx_slot(dev, dev->ring_tx_tail);
+        len = min_t(unsigned int, ACCESS_ONCE(slot->hdr.len),
+                min_t(unsigned int, size, dev->ring_req.slot_size - sizeof(A7139_SLOT)));
+        memcpy(buf, slot + 1, len);
+        a7139_slot_set_status(slot, A7139_SLOT_AVAILABLE);
+
+        dev->ring_tx_tail = (dev->ring_tx_tail + 1) % dev->ring_req.tx_slots;
+    }
+
+    return len;
+}
+
+static void a7139_ring_free(struct rf_dev *dev)
+{
+    if (dev->ring) {
+        vfree(dev->ring);
+        dev->ring = NULL;
+    }
+    dev->ring_size = 0;
+    memset(&dev->ring_req, 0, sizeof(dev->ring_req));
+    dev->ring_rx_head = 0;
+    dev->ring_tx_tail = 0;
+}
+
+static int a7139_ring_alloc(struct rf_dev *dev, const A7139_RING_REQ *req)
+{
+    size_t size;
+
+    if (req->slot_size % 16 || req->slot_size <= sizeof(A7139_SLOT) ||
+            req->slot_size > ALIGN(sizeof(A7139_SLOT) + A7139_FRAME_MAX, 16) ||
+            req->rx_slots > A7139_RING_MAX_SLOTS || req->tx_slots > A7139_RING_MAX_SLOTS) {
         return -EINVAL;
     }
 
-    a7139_write_reg(dev, SYSTEMCLOCK_REG, rate_cal_tab[drate]);
+    size = (size_t)req->slot_size * (req->rx_slots + req->tx_slots);
+    if (!size) {
+        return 0;
+    }
 
-    dev->rf_datarate = drate;
+    /* zeroed, every slot starts as A7139_SLOT_KERNEL/A7139_SLOT_AVAILABLE */
+    dev->ring = vmalloc_user(PAGE_ALIGN(size));
+    if (!dev->ring) {
+        return -ENOMEM;
+    }
+    dev->ring_size = size;
+    dev->ring_req = *req;
 
     return 0;
 }
 
-/************************************************************************
- **  FreqSet
- ************************************************************************/
-static int a7139_freq_set(struct rf_dev *dev, uint8_t ch)
+/* ARSSI=1 while someone wants per frame RSSI, the header or the rings */
+static void a7139_arssi_update(struct rf_dev *dev)
 {
-
-    if (ch >= RF_FREQ_TAB_MAXSIZE) {
-        return -EINVAL;
+    if (dev->hdr_readers || dev->ring || dev->lbt_cfg.enable) {
+        a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG] | 0x8000);
+    } else {
+        a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG]);
     }
+}
 
-#if 1
-    a7139_write_reg(dev, PLL1_REG, freq_cal_tab[2 * ch]);       // setting PLL1
-    a7139_write_reg(dev, PLL2_REG, freq_cal_tab[2 * ch + 1]);   // setting PLL2
-#else
-    uint16_t freq;
-    freq = ch * 16 * 4;                                         // per 4*200k one channel
-    a7139_write_page_b(IF2_PAGEB, freq);                        // setting for frequency offset
-#endif
-    dev->rf_freq_ch = ch;
+static void a7139_vm_open(struct vm_area_struct *vma)
+{
+    struct rf_dev *dev = vma->vm_private_data;
 
-    return 0;
+    atomic_inc(&dev->ring_mapped);
 }
 
-/*********************************************************************
- ** A7139_Cal
- *********************************************************************/
-static int a7139_cal(struct rf_dev *dev)
+static void a7139_vm_close(struct vm_area_struct *vma)
 {
-    uint8_t fbcf; // IF Filter
-    uint8_t vbcf; // VCO Current
-    uint8_t vccf; // VCO Band
-    uint16_t tmp;
+    struct rf_dev *dev = vma->vm_private_data;
 
-    // IF calibration procedure @STB state
-    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0802);   // IF Filter & VCO Current Calibration
-    do {
-        tmp = a7139_read_reg(dev, MODE_REG);
-    } while (tmp & 0x0802);
+    atomic_dec(&dev->ring_mapped);
+}
 
-    // for check(IF Filter)
-    tmp = a7139_read_reg(dev, CALIBRATION_REG);
-    fbcf = (tmp >> 4) & 0x01;
-    if (fbcf) {
-        return -EIO;
+static const struct vm_operations_struct a7139_vm_ops = {
+    .open   = a7139_vm_open,
+    .close  = a7139_vm_close,
+};
+
+static int a7139_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    int ret;
+
+    down(&dev->sem);
+
+    if (dev->gone) {
+        ret = -ENODEV;
+        goto out;
     }
 
-    // for check(VCO Current)
-    tmp = a7139_read_page_a(dev, VCB_PAGEA);
-    vccf = (tmp >> 4) & 0x01;
-    if (vccf) {
-        return -EIO;
+    if (dev->owner != f) {
+        ret = -EPERM;
+        goto out;
     }
 
-    // RSSI Calibration procedure @STB state
-    a7139_write_reg(dev, ADC_REG, 0x4C00);           // set ADC average=64
-    a7139_write_page_a(dev, WOR2_PAGEA, 0xF800);     // set RSSC_D=40us and RS_DLY=80us
-    a7139_write_page_a(dev, TX1_PAGEA, rf_reg_cfg_page_a[TX1_PAGEA] | 0xE000);  // set RC_DLY=1.5ms
-    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x1000);              // RSSI Calibration
+    if (!dev->ring || vma->vm_pgoff || size > PAGE_ALIGN(dev->ring_size)) {
+        ret = -EINVAL;
+        goto out;
+    }
 
-    do {
-        tmp = a7139_read_reg(dev, MODE_REG);
-    } while (tmp & 0x1000);
+    ret = remap_vmalloc_range(vma, dev->ring, 0);
+    if (ret) {
+        goto out;
+    }
 
-    a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG]);
-    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA]);
-    a7139_write_page_a(dev, TX1_PAGEA, rf_reg_cfg_page_a[TX1_PAGEA]);
+    vma->vm_ops = &a7139_vm_ops;
+    vma->vm_private_data = dev;
+    a7139_vm_open(vma);
 
-    // VCO calibration procedure @STB state
-    a7139_write_reg(dev, PLL1_REG, freq_cal_tab[0]);
-    a7139_write_reg(dev, PLL2_REG, freq_cal_tab[1]);
-    a7139_write_reg(dev, MODE_REG, rf_reg_cfg[MODE_REG] | 0x0004);              // VCO Band Calibration
-    do {
-        tmp = a7139_read_reg(dev, MODE_REG);
-    } while(tmp & 0x0004);
+out:
+    up(&dev->sem);
 
-    // for check(VCO Band)
-    tmp = a7139_read_reg(dev, CALIBRATION_REG);
-    vbcf = (tmp >> 8) & 0x01;
-    if (vbcf) {
-        return -EIO;
-    }
+    return ret;
+}
 
-    return 0;
+static void a7139_tx_kick(struct rf_dev *dev)
+{
+    if (!kfifo_is_empty(&dev->tx_fifo) || a7139_ring_tx_pending(dev)) {
+        queue_work(dev->work_queue, &dev->tx_work);
+    }
 }
 
-//**********************************************************************************
-//  : RFʼ
-//  : 
-// ز : 
-// ˵     :
-//**********************************************************************************
-static int a7139_chip_init(struct rf_dev *dev)
+static void a7139_rx_meta_capture(struct rf_dev *dev, ktime_t now, uint16_t status)
 {
-    // init io pin
-    gpio_pin_mo_h(dev->pin.scs);
-    gpio_pin_mo_l(dev->pin.sck);
-    gpio_pin_mo_h(dev->pin.sdio);
-    gpio_pin_mi(dev->pin.gio1);
+    if (dev->hdr_readers || dev->ring) {
+        dev->rx_meta.tstamp = ktime_to_ns(now);
+        dev->rx_meta.mode_reg = status;
+        dev->rx_meta.rssi = a7139_read_reg(dev, ADC_REG) & 0x00FF;
+        dev->rx_meta.freq_ch = dev->rf_freq_ch;
+        dev->rx_meta.datarate = dev->rf_datarate;
+    }
+}
 
-    a7139_send_ctrl(dev, CMD_RF_RST);   // reset  chip
+/*****
+ ** spectrum survey
+ *****/
+/* channels of the current channel mode */
+static unsigned int a7139_ch_count(struct rf_dev *dev)
+{
+    switch (dev->ch_cfg.mode) {
+        case A7139_CH_OFFSET:
+            return DIV_ROUND_UP(A7139_CH_SPAN_HZ, dev->ch_cfg.spacing_hz);
 
-    spi_defdelay();
+        case A7139_CH_PLAN:
+            return dev->ch_cfg.channels;
 
-    if (a7139_config(dev)) {            // config A7139 chip
-        printk(KERN_ERR "a7139_config error\n");
-        return -EIO;
+        case A7139_CH_TABLE:
+        default:
+            return RF_FREQ_TAB_MAXSIZE;
     }
+}
 
-    spi_defdelay();                     // for crystal stabilized
+/* listen on one channel for dwell_ms, called in standby */
+static int a7139_survey_ch(struct rf_dev *dev, uint8_t ch, uint16_t dwell_ms, A7139_SURVEY_CH *res)
+{
+    s64 deadline;
+    uint32_t sum = 0, n = 0;
+    uint8_t rssi;
+    int ret;
 
-    if (a7139_write_id(dev, dev->rf_id)) {  // write ID code
-        printk(KERN_ERR "a7139_write_id error\n");
-        return -EIO;
+    ret = a7139_freq_set(dev, ch);
+    if (ret) {
+        return ret;
     }
 
-    if (a7139_cal(dev)) {
-        printk(KERN_ERR "a7139_cal error\n");
-        return -EIO;                    // IF and VCO calibration
-    }
+    a7139_send_ctrl(dev, CMD_RX_MODE);
+    usleep_range(A7139_RSSI_SETTLE_US, A7139_RSSI_SETTLE_US + 500);
 
-    spi_defdelay();
+    res->min = 0xFF;
+    res->max = 0;
+    deadline = ktime_to_ns(ktime_add_us(ktime_get(), dwell_ms * 1000));
+    do {
+        rssi = a7139_read_reg(dev, ADC_REG) & 0x00FF;
+        res->min = min(res->min, rssi);
+        res->max = max(res->max, rssi);
+        sum += rssi;
+        n++;
+        usleep_range(A7139_SURVEY_SAMPLE_US, A7139_SURVEY_SAMPLE_US + 100);
+    } while (ktime_to_ns(ktime_get()) < deadline);
 
-    a7139_freq_set(dev, dev->rf_freq_ch);
-    //a7139_datarate_set(dev, dev->rf_datarate);
+    res->avg = sum / n;
+    res->reserved = 0;
+
+    a7139_send_ctrl(dev, CMD_STANDBY_MODE);
 
     return 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-//  : 
-//  : uint8_t *txBuffer:ݴ洢׵ַ,
-//            uint8_t sizeݳ
-// ز : 
-// ˵     :
-////////////////////////////////////////////////////////////////////////////////
-static void a7139_send_packet(struct rf_dev *dev, uint8_t *txBuffer, uint8_t size)
+/* called in standby, the irq thread drops edges of the survey as stale */
+static int a7139_survey(struct rf_dev *dev, A7139_SURVEY *sv)
 {
-    uint8_t i;
-    unsigned long flags;
-
-    //a7139_mode_switch(dev, A7139_MODE_STANDBY);     // enter standby mode
+    unsigned int i, count;
+    uint8_t ch = dev->rf_freq_ch;
+    int ret = 0;
 
-    local_irq_save(flags);
+    if (!sv->dwell_ms || sv->dwell_ms > A7139_SURVEY_DWELL_MAX_MS ||
+            !sv->count || sv->count > A7139_SURVEY_MAX_CHANNELS ||
+            sv->first >= a7139_ch_count(dev)) {
+        return -EINVAL;
+    }
+    count = min_t(unsigned int, sv->count, a7139_ch_count(dev) - sv->first);
+    /* the sem is held and rx is off for the whole call */
+    count = min_t(unsigned int, count, A7139_SURVEY_TOTAL_MAX_MS / sv->dwell_ms);
 
-    spi_defdelay();
-    a7139_send_ctrl(dev, CMD_TFR);                  // TX FIFO address pointer reset
+    a7139_write_reg(dev, ADC_REG, rf_reg_cfg[ADC_REG] | 0x8000);       // ARSSI=1
 
-    gpio_pin_l(dev->pin.scs);
-    a7139_byte_send(dev, CMD_DATAW);                // TX FIFO write command
+    for (i = 0; i < count; i++) {
+        if (signal_pending(current)) {
+            break;
+        }
 
-    for (i = 0; i < size; i++) {
-        a7139_byte_send(dev, txBuffer[i]);
+        ret = a7139_survey_ch(dev, sv->first + i, sv->dwell_ms, &sv->ch[i]);
+        if (ret) {
+            break;
+        }
     }
-    gpio_pin_h(dev->pin.scs);
+    sv->count = i;
+    memset(&sv->ch[i], 0, (A7139_SURVEY_MAX_CHANNELS - i) * sizeof(sv->ch[0]));
 
-    local_irq_restore(flags);
+    a7139_arssi_update(dev);
+    if (a7139_freq_set(dev, ch) && !ret) {
+        ret = -EIO;
+    }
 
-    a7139_mode_switch(dev, A7139_MODE_TX);
+    return ret;
 }
 
-///*********************************************************************
-//** A7139_WriteFIFO
-//*********************************************************************/
-//void LSD_RF_WriteFIFO(void)
-//{
-//    uint8_t i;
-//
-//    a7139_send_ctrl(CMD_TFR);        //TX FIFO address pointer reset
-//    spi_scs_l;
-//    a7139_byte_send(CMD_DATAW);    //TX FIFO write command
-//    for(i=0; i <64; i++)
-//    a7139_byte_send(PN9_Tab[i]);
-//    spi_scs_h;
-//}
-
-////////////////////////////////////////////////////////////////////////////////
-//  : ݰ
-//  : uint8_t *buf,ݴ洢׵ַ uint8_t len ݳ
-// ز : 
-// ˵     :
-////////////////////////////////////////////////////////////////////////////////
-static uint8_t a7139_receive_packet(struct rf_dev *dev, uint8_t *buf, uint8_t len)
+/*****
+ ** listen before talk
+ *****/
+/*
+ * Called with a frame in txbuf. 0: send it now, -EBUSY: held in txbuf
+ * until lbt_work, -ETIMEDOUT: dropped after max_tries busy samples.
+ */
+static int a7139_lbt_check(struct rf_dev *dev)
 {
-    uint8_t i;
-    unsigned long flags;
-
-    local_irq_save(flags);
-
-    a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
+    unsigned int window;
+    unsigned long delay;
 
-    gpio_pin_l(dev->pin.scs);
+    /* RSSI is only valid once the receiver has run for a while */
+    if (dev->rf_currmode != A7139_MODE_RX ||
+            ktime_us_delta(ktime_get(), dev->rx_since) < A7139_RSSI_SETTLE_US) {
+        if (dev->rf_currmode != A7139_MODE_RX) {
+            a7139_mode_switch(dev, A7139_MODE_RX);
+        }
+        delay = usecs_to_jiffies(A7139_RSSI_SETTLE_US);
+        goto hold;
+    }
 
-    a7139_byte_send(dev, CMD_DATAR);    // RX FIFO read command
+    dev->lbt_rssi = a7139_read_reg(dev, ADC_REG) & 0x00FF;
+    if (dev->lbt_rssi <= dev->lbt_cfg.rssi_thresh) {
+        dev->lbt_held = 0;
+        return 0;
+    }
 
-    for (i = 0; i < len; i++) {
-        buf[i] = a7139_byte_read(dev);
-        /* printk("read 0x%x\n", buf[i]); */
+    if (++dev->lbt_tries >= dev->lbt_cfg.max_tries) {
+        dev->stats.lbt_abandoned++;
+        dev->lbt_held = 0;
+        return -ETIMEDOUT;
     }
 
-    gpio_pin_h(dev->pin.scs);
+    dev->stats.lbt_deferrals++;
+    window = min_t(unsigned int, 1U << min(dev->lbt_tries, 10U), dev->lbt_cfg.max_slots);
+    delay = msecs_to_jiffies((1 + random32() % window) * dev->lbt_cfg.slot_ms);
 
-    local_irq_restore(flags);
-    /*
-    for (i = 0; i < 64; i++)
-    {
-        recv = tmpbuf[i];
-        tmp = recv ^ PN9_Tab[i];
-        if (tmp != 0)
-        {
-            Err_ByteCnt++;
-            Err_BitCnt += (bit_count_tab[tmp>>4] + bit_count_tab[tmp & 0x0F]);
-        }
-    }
-    */
+hold:
+    dev->lbt_held = 1;
+    dev->lbt_until = jiffies + delay;
+    queue_delayed_work(dev->work_queue, &dev->lbt_work, delay);
 
-    return i;
+    return -EBUSY;
 }
 
-
-#if 0
-/*********************************************************************
- ** RC Oscillator Calibration
- *********************************************************************/
-static void a7139_rcosc_cal(struct rf_dev *dev)
+/* load the next queued frame, write() queue first, then the mmap tx slots */
+static void a7139_tx_start(struct rf_dev *dev)
 {
-    uint16_t tmp;
+    uint8_t *frame = dev->txbuf + A7139_EXT_HLEN;
+    int ret;
+
+    /* a frame held by listen before talk goes first, once its backoff is over */
+    if (dev->lbt_held) {
+        if (time_before(jiffies, dev->lbt_until) ||
+                (dev->rf_currmode != A7139_MODE_RX && dev->rf_currmode != A7139_MODE_TXING)) {
+            return;
+        }
+    } else if (dev->rf_currmode == A7139_MODE_RX || dev->rf_currmode == A7139_MODE_TXING) {
+        dev->lbt_tries = 0;
+        if (!kfifo_is_empty(&dev->tx_fifo)) {
+            dev->tx_len = kfifo_out(&dev->tx_fifo, frame, dev->frame_max);
+            if (kfifo_out(&dev->tx_stamps, &dev->tx_stamp, sizeof(s64)) != sizeof(s64)) {
+                dev->tx_stamp = 0;
+            }
+        } else {
+            dev->tx_len = a7139_ring_tx(dev, frame, dev->frame_max);
+            dev->tx_stamp = 0;
+        }
+    } else {
+        dev->tx_len = 0;
+    }
 
-    a7139_write_page_a(dev, WOR2_PAGEA, rf_reg_cfg_page_a[WOR2_PAGEA] | 0x0010);        //enable RC OSC
+    if (dev->tx_len && dev->lbt_cfg.enable) {
+        ret = a7139_lbt_check(dev);
+        if (ret == -EBUSY) {
+            wake_up_interruptible(&dev->w_wait);
+            return;
+        }
+        if (ret) {
+            dev->tx_len = 0;
+            dev->tx_stamp = 0;
+            wake_up_interruptible(&dev->w_wait);
+            a7139_tx_kick(dev);
+            return;
+        }
+    }
 
-    while(1) {
-        a7139_write_page_a(dev, WCAL_PAGEA, rf_reg_cfg_page_a[WCAL_PAGEA] | 0x0001);    //set ENCAL=1 to start RC OSC CAL
-        do {
-            tmp = a7139_read_page_a(dev, WCAL_PAGEA);
-        } while(tmp & 0x0001);
+    if (dev->tx_len) {
+        wake_up_interruptible(&dev->w_wait);
 
-        tmp = (a7139_read_page_a(dev, WCAL_PAGEA) & 0x03FF);         // read NUMLH[8:0]
-        tmp >>= 1;
-        if ((tmp > 186) && (tmp < 198))                         // NUMLH[8:0]~192
-        {
-            break;
+        a7139_mode_switch(dev, A7139_MODE_TXING);
+        trace_a7139_tx_strobe(dev->name_alias, dev->tx_len, dev->rf_freq_ch);
+        if (a7139_frame_ext(dev)) {
+            a7139_ext_send(dev);
+        } else {
+            a7139_send_packet(dev, frame, dev->tx_len);
         }
     }
 }
 
-/*********************************************************************
- ** WOR_enable_by_preamble
- *********************************************************************/
-void WOR_enable_by_preamble(void)
+static void a7139_frame_release(struct kref *ref)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
+    kfree(container_of(ref, struct rf_frame, ref));
+}
 
-    A7139_WritePageA(GIO_PAGEA, 0x004D);    //GIO1=PMDO, GIO2=WTR
+static void a7139_frame_put(struct rf_frame *fr)
+{
+    kref_put(&fr->ref, a7139_frame_release);
+}
 
-    //Real WOR Active Period = (WOR_AC[5:0]+1) x 244us V X'TAL and Regulator Settling Time
-    //Note : Be aware that X tal settling time requirement includes initial tolerance,
-    //       temperature drift, aging and crystal loading.
-    A7139_WritePageA(WOR1_PAGEA, 0x8005);    //setup WOR Sleep time and Rx time
+static void a7139_rxq_flush(struct rf_file *f)
+{
+    struct rf_frame *fr;
 
-    RCOSC_Cal();         //RC Oscillator Calibration
+    while (kfifo_get(&f->rxq, &fr)) {
+        a7139_frame_put(fr);
+    }
+}
 
-    A7139_WritePageA(WOR2_PAGEA, A7139Config_PageA[WOR2_PAGEA] | 0x0030);    //enable RC OSC & WOR by preamble
+static bool a7139_filter_match(const A7139_FILTER *flt, const uint8_t *data, unsigned int len)
+{
+    const A7139_FILTER_RULE *r;
+    unsigned int i, j;
 
-    A7139_WriteReg(MODE_REG, A7139Config[MODE_REG] | 0x0200);        //WORE=1 to enable WOR function
+    if (!flt->count) {
+        return true;
+    }
 
-    while(GIO1==0);        //Stay in WOR mode until receiving preamble(preamble ok)
+    for (i = 0; i < flt->count; i++) {
+        r = &flt->rule[i];
+        for (j = 0; j < A7139_FILTER_BYTES; j++) {
+            if (r->mask[j] && (r->offset + j >= len || (data[r->offset + j] & r->mask[j]) != r->value[j])) {
+                break;
+            }
+        }
+        if (j == A7139_FILTER_BYTES) {
+            return true;
+        }
+    }
 
+    return false;
 }
 
-/*********************************************************************
- ** WOR_enable_by_sync
- *********************************************************************/
-void WOR_enable_by_sync(void)
+/* frames for f, counted against its filter otherwise */
+static bool a7139_rx_wanted(struct rf_dev *dev, struct rf_file *f, const uint8_t *data, unsigned int len)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
-
-    A7139_WritePageA(GIO_PAGEA, 0x0045);    //GIO1=FSYNC, GIO2=WTR
+    if (a7139_filter_match(&f->filter, data, len)) {
+        return true;
+    }
 
-    //Real WOR Active Period = (WOR_AC[5:0]+1) x 244us V X'TAL and Regulator Settling Time
-    //Note : Be aware that Xtal settling time requirement includes initial tolerance,
-    //       temperature drift, aging and crystal loading.
-    A7139_WritePageA(WOR1_PAGEA, 0x8005);    //setup WOR Sleep time and Rx time
+    f->filter.filtered++;
+    dev->stats.rx_filtered++;
 
-    RCOSC_Cal();         //RC Oscillator Calibration
+    return false;
+}
 
-    A7139_WritePageA(WOR2_PAGEA, A7139Config_PageA[WOR2_PAGEA] | 0x0010);    //enable RC OSC & WOR by sync
+static int a7139_filter_check(const A7139_FILTER *flt)
+{
+    unsigned int i, j;
 
-    A7139_WriteReg(MODE_REG, A7139Config[MODE_REG] | 0x0200);        //WORE=1 to enable WOR function
+    if (flt->count > A7139_FILTER_MAX_RULES) {
+        return -EINVAL;
+    }
 
-    while(GIO1==0);        //Stay in WOR mode until receiving ID code(sync ok)
+    /* value bits outside the mask never match */
+    for (i = 0; i < flt->count; i++) {
+        for (j = 0; j < A7139_FILTER_BYTES; j++) {
+            if (flt->rule[i].value[j] & ~flt->rule[i].mask[j]) {
+                return -EINVAL;
+            }
+        }
+    }
 
+    return 0;
 }
 
-/*********************************************************************
- ** WOR_enable_by_carrier
- *********************************************************************/
-void WOR_enable_by_carrier(void)
+/* one copy of the frame, referenced by every queue with room for it */
+static int a7139_rx_fanout(struct rf_dev *dev, const A7139_RX_HDR *hdr, const uint8_t *data)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
+    struct rf_file *f;
+    struct rf_frame *fr = NULL;
+    int queued = 0;
 
-    A7139_WritePageA(GIO_PAGEA, 0x0049);    //GIO1=CD, GIO2=WTR
+    list_for_each_entry(f, &dev->files, node) {
+        /* the owner reads the mmap ring instead */
+        if (dev->ring && f == dev->owner) {
+            continue;
+        }
 
-    //Real WOR Active Period = (WOR_AC[5:0]+1) x 244us V X'TAL and Regulator Settling Time
-    //Note : Be aware that Xtal settling time requirement includes initial tolerance,
-    //       temperature drift, aging and crystal loading.
-    A7139_WritePageA(WOR1_PAGEA, 0x8005);    //setup WOR Sleep time and Rx time
+        if (!a7139_rx_wanted(dev, f, data, hdr->len)) {
+            continue;
+        }
 
-    RCOSC_Cal();         //RC Oscillator Calibration
+        if (kfifo_is_full(&f->rxq)) {
+            dev->stats.rx_dropped++;
+            continue;
+        }
 
-    A7139_WritePageA(WOR2_PAGEA, A7139Config_PageA[WOR2_PAGEA] | 0x0410);    //enable RC OSC & WOR by carrier
-    A7139_WriteReg(ADC_REG, A7139Config[ADC_REG] | 0x8096);            //ARSSI=1, RTH=150
-    A7139_WritePageA(RFI_PAGEA, A7139Config_PageA[RFI_PAGEA] | 0x6000);    //RSSI Carrier Detect plus In-band Carrier Detect
-    A7139_WritePageB(ACK_PAGEB, A7139Config_PageB[ACK_PAGEB] | 0x0200);    //CDRS=[01]
-    A7139_WritePageA(VCB_PAGEA, A7139Config_PageA[VCB_PAGEA] | 0x4000);    //CDTM=[01]
+        if (!fr) {
+            fr = kmalloc(sizeof(*fr) + hdr->len, GFP_KERNEL);
+            if (!fr) {
+                dev->stats.rx_dropped++;
+                break;
+            }
+            kref_init(&fr->ref);
+            fr->stamp = dev->rx_stamp;
+            fr->hdr = *hdr;
+            memcpy(fr->data, data, hdr->len);
+        }
 
-    A7139_WriteReg(MODE_REG, A7139Config[MODE_REG] | 0x0200);        //WORE=1 to enable WOR function
+        kref_get(&fr->ref);
+        kfifo_put(&f->rxq, &fr);
+        queued++;
+    }
 
-    while(GIO1==0);        //Stay in WOR mode until carrier signal strength is greater than the value set by RTH[7:0](carrier ok)
+    if (fr) {
+        a7139_frame_put(fr);
+    }
 
+    return queued;
 }
 
-/*********************************************************************
- ** WOT_enable
- *********************************************************************/
-void WOT_enable(void)
+/* rx completion, called from the irq thread with a good frame in the FIFO */
+static void a7139_rx_done(struct rf_dev *dev)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
-
-    A7139_WritePageA(GIO_PAGEA, 0x0045);    //GIO1=FSYNC, GIO2=WTR
-
-    //Real WOR Active Period = (WOR_AC[5:0]+1) x 244us V X'TAL and Regulator Settling Time
-    //Note : Be aware that Xtal settling time requirement includes initial tolerance,
-    //       temperature drift, aging and crystal loading.
-    A7139_WritePageA(WOR1_PAGEA, 0x8005);    //setup WOR Sleep time and Rx time
+    A7139_RX_HDR *hdr;
+    unsigned int len;
+    int delivered = 0;
 
-    RCOSC_Cal();             //RC Oscillator Calibration
+    a7139_mode_switch(dev, A7139_MODE_RXING);
 
-    A7139_WriteFIFO();        //write data to TX FIFO
-
-    A7139_WriteReg(PIN_REG, A7139Config[PIN_REG] | 0x0400);        //WMODE=1 select WOT function
-
-    A7139_WriteReg(MODE_REG, A7139Config[MODE_REG] | 0x0200);    //WORE=1 to enable WOR function
+    hdr = (A7139_RX_HDR *)dev->rxbuf;
+    if (a7139_frame_ext(dev)) {
+        len = dev->rx_len;          /* already drained on FPF */
+    } else {
+        trace_a7139_rx_drain_start(dev->name_alias, RF_BUFSIZE, dev->rf_freq_ch);
+        len = a7139_receive_packet(dev, dev->rxbuf + sizeof(*hdr), RF_BUFSIZE);
+    }
+    trace_a7139_rx_drain_end(dev->name_alias, len, dev->rf_freq_ch);
+    *hdr = dev->rx_meta;
+    hdr->len = len;
+
+    /* a full ring or queue keeps its frames and misses this one */
+    if (dev->ring && a7139_rx_wanted(dev, dev->owner, dev->rxbuf + sizeof(*hdr), len)) {
+        if (a7139_ring_rx(dev, hdr, dev->rxbuf + sizeof(*hdr))) {
+            dev->stats.rx_dropped++;
+        } else {
+            delivered++;
+        }
+    }
+    delivered += a7139_rx_fanout(dev, hdr, dev->rxbuf + sizeof(*hdr));
 
-    while(1);
+    /* nobody wakes for a frame all filters dropped */
+    if (delivered) {
+        dev->stats.rx_frames++;
+        trace_a7139_rx_wake(dev->name_alias, hdr->len, dev->rf_freq_ch);
+        wake_up_interruptible(&dev->r_wait);
+    } else {
+        debugf("%s rx frame not queued, %u dropped\n", dev->name_alias, dev->stats.rx_dropped);
+    }
 
+    a7139_mode_switch(dev, A7139_MODE_RX);
+    a7139_tx_start(dev);
 }
 
-/*********************************************************************
- ** TWOR_enable
- *********************************************************************/
-void TWOR_enable(void)
+/* tx completion, the next queued frame goes out back-to-back */
+static void a7139_tx_done(struct rf_dev *dev)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
-
-    A7139_WritePageA(GIO_PAGEA, 0x0051);    //GIO1=TWOR, GIO2=WTR
-
-    //Real WOR Active Period = (WOR_AC[5:0]+1) x 244us V X'TAL and Regulator Settling Time
-    //Note : Be aware that Xtal settling time requirement includes initial tolerance,
-    //       temperature drift, aging and crystal loading.
-    A7139_WritePageA(WOR1_PAGEA, 0x8005);    //setup WOR Sleep time and Rx time
-
-    RCOSC_Cal();             //RC Oscillator Calibration
+    trace_a7139_tx_done(dev->name_alias, dev->tx_len, dev->rf_freq_ch);
 
-    A7139_WritePageA(WOR2_PAGEA, A7139Config_PageA[WOR2_PAGEA] | 0x0014);    //start TWOR by WOR_AC
-    //A7139_WritePageA(WOR2_PAGEA, A7139Config_PageA[WOR2_PAGEA] | 0x001C);    //start TWOR by WOR_SL
-
-    StrobeCMD(CMD_SLEEP);    //entry sleep mode
+    dev->stats.tx_frames++;
+    if (dev->tx_stamp) {
+        a7139_hist_add(dev->stats.write_to_txdone, dev->tx_stamp, dev->irq_stamp);
+        dev->tx_stamp = 0;
+    }
 
-    while(1);
+    if (dev->ack_cfg.auto_resend) {
+        a7139_ack_result(dev);
+    }
 
+    if (!kfifo_is_empty(&dev->tx_fifo) || a7139_ring_tx_pending(dev)) {
+        a7139_mode_switch(dev, A7139_MODE_TXING);
+        a7139_tx_start(dev);
+    } else {
+        a7139_mode_switch(dev, A7139_MODE_RX);
+        /* an ioctl may wait for the air to be free */
+        wake_up_interruptible(&dev->w_wait);
+    }
 }
 
-/*********************************************************************
- ** RSSI_measurement
- *********************************************************************/
-void RSSI_measurement(void)
+/*
+ * FPF while receiving, drain one segment. The first one carries the
+ * frame length, the tail segment comes in one FPF later with trailing
+ * noise since INFS=1 keeps the receiver running.
+ */
+static void a7139_ext_rx_chunk(struct rf_dev *dev, ktime_t now)
 {
-    uint16_t tmp;
+    uint8_t *buf = dev->rxbuf + sizeof(A7139_RX_HDR) - A7139_EXT_HLEN;
+    unsigned int end;
+    uint16_t crc;
 
-    StrobeCMD(CMD_STANDBY_MODE);
+    if (dev->rx_pos == 0) {
+        trace_a7139_rx_drain_start(dev->name_alias, 0, dev->rf_freq_ch);
+    }
 
-    A7139_WritePageA(GIO_PAGEA, 0x0045);            //GIO1=FSYNC, GIO2=WTR
+    dev->bus->read(dev, CMD_DATAR, buf + dev->rx_pos, RF_BUFSIZE);
+    dev->rx_pos += RF_BUFSIZE;
 
-    A7139_WriteReg(ADC_REG, A7139Config[ADC_REG] | 0x8000);    //ARSSI=1
+    if (dev->rx_pos == RF_BUFSIZE) {
+        dev->rx_len = buf[0] | (buf[1] << 8);
+        if (dev->rx_len > dev->frame_max) {
+            printk(KERN_ERR "%s read bad frame length %u\n", dev->name_alias, dev->rx_len);
+            a7139_mode_switch(dev, A7139_MODE_RX);
+            return;
+        }
+        dev->rx_air = a7139_ext_air_len(dev->rx_len);
+    }
 
-    StrobeCMD(CMD_RX_MODE);    //entry RX mode
-    Delay10us(1);
+    if (dev->rx_pos < dev->rx_air) {
+        return;
+    }
 
-    while(GIO1==0)        //Stay in WOR mode until receiving ID code(sync ok)
-    {
-        tmp = (A7139_ReadReg(ADC_REG) & 0x00FF);    //read RSSI value(environment RSSI)
+    end = A7139_EXT_HLEN + dev->rx_len;
+    crc = buf[end] | (buf[end + 1] << 8);
+    if (crc != crc_ccitt(0xFFFF, buf, end)) {
+        dev->stats.rx_crc_err++;
+        trace_a7139_rx_crc_fail(dev->name_alias, 0, dev->rf_freq_ch);
+        printk(KERN_ERR "%s read crc error\n", dev->name_alias);
+        a7139_mode_switch(dev, A7139_MODE_RX);
+        return;
     }
-    tmp = (A7139_ReadReg(ADC_REG) & 0x00FF);        //read RSSI value(wanted signal RSSI)
 
+    a7139_rx_meta_capture(dev, now, a7139_read_reg(dev, MODE_REG));
+    a7139_rx_done(dev);
 }
 
-/*********************************************************************
- ** FIFO_extension_Infinite_TX
- *********************************************************************/
-void FIFO_extension_Infinite_TX(void)
+/*
+ * Send the next queued frame when write(), poll() or an ioctl queued one
+ * while the radio was idle in rx. Frames queued behind a running tx are
+ * started by the irq thread.
+ */
+void a7139_writework_func(struct work_struct *work)
 {
-    uint8_t i, n;
-    uint16_t j;
+    struct rf_dev *dev;
 
-    //for Infinite : FEP[13:0]=remainder,  5 < FEP[13:0] < 63
-    A7139_WritePageA(VCB_PAGEA, 0x0004);
-    A7139_WritePageA(FIFO_PAGEA, 0x0006);
+    dev = container_of(work, struct rf_dev, tx_work);
 
-    A7139_WritePageA(GIO_PAGEA, 0x0075);    //GIO1=FPF, GIO2=WTR
-    A7139_WritePageA(CKO_PAGEA, 0xD283);    //CKO=DCK
+    down(&dev->sem);
+    a7139_tx_start(dev);
+    up(&dev->sem);
+}
 
-    A7139_WriteReg(PIN_REG, 0x0A00);    //set INFS=1, infinite length
+/* retry of a frame held by listen before talk */
+static void a7139_lbt_work_func(struct work_struct *work)
+{
+    struct rf_dev *dev = container_of(to_delayed_work(work), struct rf_dev, lbt_work);
 
-    n=0;
+    down(&dev->sem);
+    a7139_tx_start(dev);
+    up(&dev->sem);
+}
 
-    SCS=0;
-    ByteSend(CMD_DATAW);                //write 1st TX FIFO 64bytes
-    for(i=0; i<64; i++)
-    {
-        ByteSend(n);
-        if(n==255)
-            n=0;
-        else
-            n++;
+/* hard irq half, only stamps the edge, the chip is accessed from the thread */
+static irqreturn_t a7139_hardirq(int irq, void *dev_id)
+{
+    struct rf_dev *dev = (struct rf_dev *)dev_id;
+    unsigned int gen = ACCESS_ONCE(dev->mode_gen);
+
+    spin_lock(&dev->irq_lock);
+    /* a later edge, a replay from before a mode switch included, never hides a current one */
+    if (!dev->irq_pending || dev->irq_gen != gen) {
+        dev->irq_stamp = ktime_get();
+        dev->irq_gen = gen;
+        dev->irq_pending = 1;
     }
-    SCS=1;
-
-    StrobeCMD(CMD_TX);            //entry TX mode
+    dev->stats.irqs++;
+    spin_unlock(&dev->irq_lock);
 
-    for(j=0; j<500; j++)
-    {
-        while(GIO1==0);            //wait FPF go high
-        while(GIO1==1);            //wait FPF go low
+    return IRQ_WAKE_THREAD;
+}
 
-        SCS=0;
-        ByteSend(CMD_DATAW);    //write TX FIFO 64bytes
-        for(i=0; i <64; i++)
-        {
-            ByteSend(n);
-            if(n==255)
-                n=0;
-            else
-                n++;
+/* once the irq is requested, the thread exists from then on */
+static void a7139_irq_thread_setup(struct rf_dev *dev)
+{
+    struct sched_param param = { .sched_priority = irq_prio };
+    struct irq_desc *desc = irq_to_desc(dev->irq);
+    struct irqaction *action;
+
+    for (action = desc ? desc->action : NULL; action; action = action->next) {
+        if (action->dev_id == dev && action->thread) {
+            dev->irq_task = action->thread;
+            sched_setscheduler(action->thread, irq_prio > 0 ? SCHED_FIFO : SCHED_NORMAL, &param);
         }
-        SCS=1;
     }
+}
 
-    //remainder : FEP[13:0]=6, FIFO Length=6+1=7
-    while(GIO1==0);                //wait last FPF go high
-    while(GIO1==1);                //wait last FPF go low
-
-    SCS=0;
-    ByteSend(CMD_DATAW);        //write TX FIFO 7bytes
-    for(i=0; i<7; i++)
-    {
-        ByteSend(n);
-        if(n==255)
-            n=0;
-        else
-            n++;
+/*
+ * The radio was switched after this edge: by an ioctl, or the edge was
+ * latched while mode_switch() had the irq off and replayed later. As
+ * WTR, GIO1 is still high while the chip is busy in rx/tx, a real
+ * completion has brought it low.
+ */
+static bool a7139_edge_stale(struct rf_dev *dev, unsigned int gen)
+{
+    if (gen != dev->mode_gen) {
+        return true;
     }
-    SCS=1;
 
-    A7139_WriteReg(PIN_REG, 0x0800);    //disable INFS
-
-    while(GIO2);    //wait transmit completed
+    return !a7139_frame_ext(dev) && !dev->wor_armed &&
+            (dev->rf_currmode == A7139_MODE_RX || dev->rf_currmode == A7139_MODE_TX) &&
+            gpio_pin_in(dev->pin.gio1);
 }
 
-/*********************************************************************
- ** FIFO_extension_Infinite_RX
- *********************************************************************/
-void FIFO_extension_Infinite_RX(void)
+static irqreturn_t a7139_interrupt(int irq, void *dev_id)
 {
-    uint8_t i, n;
-    uint8_t recv;
-    uint8_t tmp;
-    uint16_t j;
-
-    //for Infinite : FEP[13:0]=remainder,  5 < FEP[13:0] < 63
-    A7139_WritePageA(VCB_PAGEA, 0x0004);
-    A7139_WritePageA(FIFO_PAGEA, 0x0006);
+    struct rf_dev *dev = (struct rf_dev *)dev_id;
+    unsigned long flags;
+    unsigned int gen;
+    ktime_t now;
+    uint16_t status;
 
-    A7139_WritePageA(GIO_PAGEA, 0x0075);    //GIO1=FPF, GIO2=WTR
-    A7139_WritePageA(CKO_PAGEA, 0xD28B);    //CKO=RCK
+    down(&dev->sem);
 
-    A7139_WriteReg(PIN_REG, 0x0A00);        //set INFS=1, infinite length
+    spin_lock_irqsave(&dev->irq_lock, flags);
+    now = dev->irq_stamp;
+    gen = dev->irq_gen;
+    dev->irq_pending = 0;
+    spin_unlock_irqrestore(&dev->irq_lock, flags);
 
-    Err_ByteCnt=0;
-    Err_BitCnt=0;
-    n=0;
+    debugf("%s a7139_interrupt: rf_currmode:%d\n", dev->name_alias, dev->rf_currmode);
+    trace_a7139_irq(dev->name_alias, dev->rf_currmode, dev->rf_freq_ch);
 
-    StrobeCMD(CMD_RX_MODE);            //entry RX mode
+    if (a7139_edge_stale(dev, gen)) {
+        dev->stats.irqs_stale++;
+        up(&dev->sem);
 
-    for(j=0; j<501 ; j++)
-    {
-        while(GIO1==0);            //wait FPF go high
-        while(GIO1==1);            //wait FPF go low
+        return IRQ_HANDLED;
+    }
 
-        SCS=0;
-        ByteSend(CMD_DATAR);    //read RX FIFO 64bytes
-        for(i=0; i<64; i++)
-            tmpbuf[i]=ByteRead();
-        SCS=1;
+    dev->rx_stamp = ktime_to_ns(now);
 
-        //for check
-        for(i=0; i<64; i++)
-        {
-            recv = tmpbuf[i];
-            tmp = recv ^ n;
-            if(tmp!=0)
-            {
-                Err_ByteCnt++;
-                Err_BitCnt += (bit_count_tab[tmp>>4] + bit_count_tab[tmp & 0x0F]);
-            }
+    if (dev->rf_currmode == A7139_MODE_RX && a7139_frame_ext(dev)) {
+        a7139_ext_rx_chunk(dev, now);
+    }
+    else if (dev->rf_currmode == A7139_MODE_RX) {
 
-            if(n==255)
-                n=0;
-            else
-                n++;
+        if (dev->wor_armed) {
+            dev->wor_wakes++;
         }
-    }
 
-    A7139_WriteReg(PIN_REG, 0x0800);    //disable INFS
+        /* check the hardware crc correct */
+        status = a7139_read_reg(dev, MODE_REG);
+        a7139_rx_meta_capture(dev, now, status);
 
-    while(GIO2);    //wait receive completed
+        if ((status & 0x0200) && dev->wor_armed) {
+            /* woken by noise or a preamble/carrier without a good frame */
+            dev->wor_false_wakes++;
+            a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
 
-    //remainder : FEP[13:0]=6, FIFO Length=6+1=7
-    SCS=0;
-    ByteSend(CMD_DATAR);        //read RX FIFO 7bytes
-    for(i=0; i<7; i++)
-        tmpbuf[i]=ByteRead();
-    SCS=1;
+            a7139_mode_switch(dev, A7139_MODE_RX);
+        }
+        else if (status & 0x0200) {
+            dev->stats.rx_crc_err++;
+            trace_a7139_rx_crc_fail(dev->name_alias, status, dev->rf_freq_ch);
+            printk(KERN_ERR "%s read crc error\n", dev->name_alias);
+            a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
+            a7139_reg_dump(dev);
 
-    //for check
-    for(i=0; i<7; i++)
-    {
-        recv = tmpbuf[i];
-        tmp = recv ^ n;
-        if(tmp!=0)
-        {
-            Err_ByteCnt++;
-            Err_BitCnt += (bit_count_tab[tmp>>4] + bit_count_tab[tmp & 0x0F]);
+            a7139_mode_switch(dev, A7139_MODE_RX);
+        }
+        else {
+            a7139_rx_done(dev);
         }
+    }
+    else if (dev->rf_currmode == A7139_MODE_TX && dev->tx_pos < dev->tx_air) {
+        a7139_ext_tx_chunk(dev);
+    }
+    else if (dev->rf_currmode == A7139_MODE_TX) {
+        a7139_tx_done(dev);
+    }
+
+    up(&dev->sem);
+
+    return IRQ_HANDLED;
+}
 
-        if(n==255)
-            n=0;
-        else
-            n++;
+//**********************************************************************************
+//  : RF deviceʼ
+//  : 
+// ز : 
+// ˵     :
+//**********************************************************************************
+static int a7139_dev_init(struct rf_dev *dev)
+{
+    struct rf_file *f;
+
+    dev->rf_datarate = RF_DEF_RATE;
+    dev->rf_freq_ch = RF_DEF_FREQ_CH;
+    memset(&dev->ch_cfg, 0, sizeof(dev->ch_cfg));
+    dev->ch_cfg.base = RF_DEF_FREQ_CH;
+    dev->rf_id[0] = RF_DEF_ID_D0;
+    dev->rf_id[1] = RF_DEF_ID_D1;
+    dev->rf_tx2 = rf_reg_cfg_page_b[TX2_PAGEB];
+    dev->rf_code = rf_reg_cfg_page_a[CODE_PAGEA];
+    dev->tx_len = 0;
+    list_for_each_entry(f, &dev->files, node) {
+        a7139_rxq_flush(f);
     }
+    kfifo_reset(&dev->tx_fifo);
+    kfifo_reset(&dev->tx_stamps);
+    dev->tx_stamp = 0;
+    wake_up_interruptible(&dev->w_wait);
+
+    /* chip_init() leaves ACK_PAGEB/ART_PAGEB at the defaults, ack off */
+    memset(&dev->ack_cfg, 0, sizeof(dev->ack_cfg));
+    dev->tx_seq = 0;
+    kfifo_reset(&dev->tx_res);
+
+    /* transmit at once until A7139_IOC_SETLBT */
+    memset(&dev->lbt_cfg, 0, sizeof(dev->lbt_cfg));
+    dev->lbt_held = 0;
+    dev->lbt_rssi = 0;
+
+    /* continuous rx until A7139_IOC_SETWOR */
+    memset(&dev->wor_cfg, 0, sizeof(dev->wor_cfg));
+    dev->wor_armed = 0;
+    dev->wor_wakes = 0;
+    dev->wor_false_wakes = 0;
+
+    return 0;
 }
 
-/*********************************************************************
- ** Auto_Resend
- *********************************************************************/
-void Auto_Resend(void)
+static ssize_t a7139_read(struct file *filp, char __user *buf, size_t count, loff_t *ppos)
 {
-    StrobeCMD(CMD_STANDBY_MODE);
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
+    struct rf_frame *fr;
+    ssize_t ret = 0;
+    const void *src;
+    unsigned int len;
 
-    A7139_WritePageA(GIO_PAGEA, 0x0071);    //GIO1=VPOAK, GIO2=WTR
-    A7139_WritePageA(CKO_PAGEA, 0xD283);    //CKO=DCK
+    debugf("a7139_read\n");
 
-    A7139_WritePageB(ACK_PAGEB, 0x003F);    //enable Auto Resend, by event, fixed, ARC=15
-    A7139_WritePageB(ART_PAGEB, 0x001E);    //RND=0, ARD=30
-    //ACK format = Preamble + ID = 8bytes
-    //data rate=10kbps, Transmission Time=(1/10k)*8*8=6.4ms
-    //so set ARD=30, RX time=30*250us=7.75ms
+    down(&dev->sem);
 
-    while(1)
-    {
-        A7139_WriteFIFO();
-        StrobeCMD(CMD_TX);        //entry TX mode
-        Delay10us(1);
-        while(GIO2);            //wait transmit completed
+    /* another thread reading this file may take the frame first */
+    while (!kfifo_get(&f->rxq, &fr)) {
+        up(&dev->sem);
 
-        //check VPOAK
-        if(GIO1)
-        {
-            //ACK ok
+        /* frames received before the removal are still read */
+        if (dev->gone) {
+            return -ENODEV;
         }
-        else
-        {
-            //NO ACK
+
+        if (filp->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
         }
 
-        StrobeCMD(CMD_STANDBY_MODE);    //clear VPOAK(GIO1 signal)
+        if (wait_event_interruptible(dev->r_wait, !kfifo_is_empty(&f->rxq) || dev->gone)) {
+            return -ERESTARTSYS;
+        }
 
-        Delay10ms(1);
+        down(&dev->sem);
     }
-}
-
-/*********************************************************************
- ** Auto_ACK
- *********************************************************************/
-void Auto_ACK(void)
-{
-    A7139_WritePageA(GIO_PAGEA, 0x0045);    //GIO1=FSYNC, GIO2=WTR
-    A7139_WritePageA(CKO_PAGEA, 0xD28B);    //CKO=RCK
-
-    A7139_WritePageB(ACK_PAGEB, 0x0001);    //enable Auto ACK
 
-    while(1)
-    {
-        StrobeCMD(CMD_RX_MODE);        //entry RX mode
-        Delay10us(1);
-        while(GIO2);            //wait receive completed
+    if (f->rx_fmt == A7139_RXFMT_HDR) {
+        src = &fr->hdr;
+        len = sizeof(fr->hdr) + fr->hdr.len;
+    } else {
+        src = fr->data;
+        len = fr->hdr.len;
+    }
 
-        RxPacket();
+    /* one frame per call, the rest of a frame longer than count is discarded */
+    len = min_t(unsigned int, len, count);
+    if (copy_to_user(buf, src, len)) {
+        printk(KERN_ERR "%s: copy_to_user error\n", dev->name_alias);
+        ret = -EFAULT;
+    } else {
+        //printk("read %d bytes from %s\n", len, dev->name_alias);
+        ret = len;
+        trace_a7139_read(dev->name_alias, len, dev->rf_freq_ch);
+        a7139_hist_add(dev->stats.irq_to_read, fr->stamp, ktime_get());
     }
-}
+    a7139_frame_put(fr);
 
-/*********************************************************************
- ** entry_deep_sleep_mode
- *********************************************************************/
-void entry_deep_sleep_mode(void)
-{
-    StrobeCMD(CMD_RF_RST);            //RF reset
+    up(&dev->sem);
 
-    A7139_WriteReg(PIN_REG, 0x0800);    //SCMDS=1
-    A7139_WritePageA(PM_PAGEA, 0x0170);    //QDS=1
-    StrobeCMD(CMD_SLEEP);            //entry sleep mode
-    Delay100us(6);                //for VDD_A shutdown, C load=0.1uF
-    StrobeCMD(CMD_DEEP_SLEEP);        //entry deep sleep mode
-    Delay100us(2);                //for VDD_D shutdown, C load=0.1uF
+    return ret;
 }
 
-/*********************************************************************
- ** wake_up_from_deep_sleep_mode
- *********************************************************************/
-void wake_up_from_deep_sleep_mode(void)
+/* a tx_fifo record of len bytes and its stamp fit */
+static bool a7139_tx_room(struct rf_dev *dev, unsigned int len)
 {
-    StrobeCMD(CMD_STANDBY_MODE);    //wake up (any Strobe CMD)
-    Delay100us(3);        //for VDD_D stabilized
-    InitRF();
+    return kfifo_avail(&dev->tx_fifo) >= len && kfifo_avail(&dev->tx_stamps) >= sizeof(s64);
 }
-#endif
 
-static int a7139_pin_init(struct rf_dev *dev)
+static ssize_t a7139_write(struct file *filp, const char __user *buf, size_t count, loff_t *ppos)
 {
-    int result;
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
+    unsigned int len, copied;
+    s64 stamp;
+    long err;
+
+    /* nothing to send, not even an empty frame; the ring owner's doorbell for filled tx slots */
+    if (count == 0) {
+        down(&dev->sem);
+        if (dev->gone) {
+            up(&dev->sem);
+
+            return -ENODEV;
+        }
+        if (dev->ring && f == dev->owner) {
+            a7139_tx_kick(dev);
+        }
+        up(&dev->sem);
 
-    result = gpio_request_one(dev->pin.scs, GPIOF_OUT_INIT_HIGH, DEVICE_NAME);
-    if (result) {
-        goto err;
-    }
-    result = gpio_request_one(dev->pin.sck, GPIOF_OUT_INIT_LOW, DEVICE_NAME);
-    if (result) {
-        goto err;
-    }
-    result = gpio_request_one(dev->pin.sdio, GPIOF_IN, DEVICE_NAME);
-    if (result) {
-        goto err;
-    }
-    result = gpio_request_one(dev->pin.gio1, GPIOF_IN, DEVICE_NAME);
-    if (result) {
-        goto err;
+        return 0;
     }
 
-    return 0;
-
-err:
-    gpio_free(dev->pin.scs);
-    gpio_free(dev->pin.sck);
-    gpio_free(dev->pin.sdio);
-    gpio_free(dev->pin.gio1);
-
-    return -EBUSY;
-}
+    len = (count > dev->frame_max ? dev->frame_max : count);
 
-static void a7139_pin_free(struct rf_dev *dev)
-{
-    gpio_free(dev->pin.scs);
-    gpio_free(dev->pin.sck);
-    gpio_free(dev->pin.sdio);
-    gpio_free(dev->pin.gio1);
-}
+    /* only waits while the tx queue is full, O_NONBLOCK gets -EAGAIN below */
+    if (!(filp->f_flags & O_NONBLOCK)) {
+        err = wait_event_interruptible_timeout(dev->w_wait, a7139_tx_room(dev, len) || dev->gone,
+                msecs_to_jiffies(DEV_WRITE_TIMEOUT));
 
-void a7139_readwork_func(struct work_struct *work)
-{
-    struct rf_dev *dev;
+        if (err < 0) {
+            return -ERESTARTSYS;
+        }
+        if (err == 0) {
+            debugf("a7139_write wait_event_interruptible_timeout\n");
+            dev->stats.tx_timeouts++;
+            return -EAGAIN;
+        }
+    }
 
-    dev = container_of(work, struct rf_dev, work);
+    debugf("a7139_write\n");
 
     down(&dev->sem);
 
-    if (dev->rf_currmode == A7139_MODE_RXING) {
-        memset((void*)dev->rxbuf, 0, RF_BUFSIZE);
-        dev->rx_len = a7139_receive_packet(dev, dev->rxbuf, RF_BUFSIZE);
-        dev->rf_rxevt = 1;
-        wake_up_interruptible(&dev->r_wait);
-        a7139_mode_switch(dev, A7139_MODE_RX);
+    if (dev->gone) {
+        up(&dev->sem);
+
+        return -ENODEV;
     }
 
-    up(&dev->sem);
-}
+    if (!a7139_tx_room(dev, len)) {
+        up(&dev->sem);
 
-void a7139_writework_func(struct work_struct *work)
-{
-    struct rf_dev *dev;
+        return -EAGAIN;
+    }
 
-    dev = container_of(work, struct rf_dev, work);
+    if (kfifo_from_user(&dev->tx_fifo, buf, len, &copied)) {
+        printk(KERN_ERR "%s: copy_from_user error\n", dev->name_alias);
+        up(&dev->sem);
 
-    down(&dev->sem);
+        return -EFAULT;
+    }
 
-    if (dev->rf_currmode == A7139_MODE_TXING) {
-        a7139_send_packet(dev, dev->txbuf, dev->tx_len);
-        memset((void*)dev->txbuf, 0, RF_BUFSIZE);
-        dev->rf_txevt = 0;
-        dev->tx_len = 0;
+    /* another writer took the space */
+    if (copied == 0) {
+        up(&dev->sem);
+
+        return -EAGAIN;
     }
 
+    stamp = ktime_to_ns(ktime_get());
+    kfifo_in(&dev->tx_stamps, &stamp, sizeof(s64));
+    trace_a7139_write(dev->name_alias, copied, dev->rf_freq_ch);
+
+    a7139_tx_kick(dev);
+
     up(&dev->sem);
+
+    return copied;
 }
 
-static irqreturn_t a7139_interrupt(int irq, void *dev_id)
+static unsigned int a7139_poll(struct file *filp, struct poll_table_struct *wait)
 {
-    struct rf_dev *dev = (struct rf_dev *)dev_id;
-    uint16_t status;
-
-    debugf("%s a7139_interrupt: rf_currmode:%d\n", dev->name_alias, dev->rf_currmode);
+    unsigned int mask = 0;
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
 
-    if (dev->rf_currmode == A7139_MODE_RX) {
+    debugf("a7139_poll: rxlen:%d, txlen:%d\n", kfifo_len(&f->rxq), kfifo_len(&dev->tx_fifo));
 
-        /* check the hardware crc correct */
-        status = a7139_read_reg(dev, MODE_REG);
+    down(&dev->sem);
 
-        if (status & 0x0200) {
-            printk(KERN_ERR "%s read crc error\n", dev->name_alias);
-            a7139_send_ctrl(dev, CMD_RFR);      // RX FIFO address pointer reset
-            a7139_reg_dump(dev);
+    poll_wait(filp, &dev->r_wait, wait);
+    poll_wait(filp, &dev->w_wait, wait);
 
-            a7139_mode_switch(dev, A7139_MODE_RX);
+    if (dev->gone) {
+        mask |= POLLERR | POLLHUP;
+    } else if (dev->ring && f == dev->owner) {
+        /* like PACKET_MMAP, readable while the last filled slot is not given back */
+        if (dev->ring_req.rx_slots &&
+                a7139_slot_status(a7139_rx_slot(dev, (dev->ring_rx_head + dev->ring_req.rx_slots - 1) %
+                        dev->ring_req.rx_slots)) != A7139_SLOT_KERNEL) {
+            mask |= POLLIN | POLLRDNORM;
         }
-        else {
-            a7139_mode_switch(dev, A7139_MODE_RXING);
-
-            INIT_WORK(&dev->work, a7139_readwork_func);
-            queue_work(dev->work_queue, &dev->work);
+        if (dev->ring_req.tx_slots &&
+                a7139_slot_status(a7139_tx_slot(dev, dev->ring_tx_tail)) == A7139_SLOT_AVAILABLE) {
+            mask |= POLLOUT | POLLWRNORM;
+        }
+    } else {
+        if (!kfifo_is_empty(&f->rxq)) {
+            mask |= POLLIN | POLLRDNORM;
+        }
+        if ((f->mode & FMODE_WRITE) && a7139_tx_room(dev, dev->frame_max)) {
+            mask |= POLLOUT | POLLWRNORM;
         }
     }
-    else if (dev->rf_currmode == A7139_MODE_TX) {
-        dev->rf_txevt = 1;
-        wake_up_interruptible(&dev->w_wait);
 
-        a7139_mode_switch(dev, A7139_MODE_RX);
+    if (f == dev->owner && !kfifo_is_empty(&dev->tx_res)) {
+        mask |= POLLPRI;
     }
 
-    return IRQ_RETVAL(IRQ_HANDLED);
-}
+    up(&dev->sem);
 
-//**********************************************************************************
-//  : RF deviceʼ
-//  : 
-// ز : 
-// ˵     :
-//**********************************************************************************
-static int a7139_dev_init(struct rf_dev *dev)
-{
-    dev->rf_datarate = RF_DEF_RATE;
-    dev->rf_freq_ch = RF_DEF_FREQ_CH;
-    dev->rf_id[0] = RF_DEF_ID_D0;
-    dev->rf_id[1] = RF_DEF_ID_D1;
-    dev->rx_len = 0;
-    dev->tx_len = 0;
-    dev->rf_rxevt = 0;
-    dev->rf_txevt = 1;
+    return mask;
+}
 
-    return 0;
+/*****
+ ** batch configuration
+ *****/
+static void a7139_cfg_get(struct rf_dev *dev, A7139_CFG *cfg)
+{
+    memcpy(cfg->id, dev->rf_id, RF_IDSIZE);
+    cfg->freq_ch = dev->rf_freq_ch;
+    cfg->datarate = dev->rf_datarate;
+    cfg->tx_power = dev->rf_tx2;
+    cfg->code = ((dev->rf_code & A7139_CODE_FECS) ? A7139_CODE_FEC : 0) |
+            ((dev->rf_code & A7139_CODE_CRCS) ? A7139_CODE_CRC : 0);
+    memset(cfg->reserved, 0, sizeof(cfg->reserved));
 }
 
-static ssize_t a7139_read(struct file *filp, char __user *buf, size_t count, loff_t *ppos)
+/* puts back what a7139_cfg_set applied before the failing write */
+static void a7139_cfg_undo(struct rf_dev *dev, const A7139_CFG *old, uint16_t applied)
 {
-    struct rf_dev *dev = filp->private_data;
-    ssize_t ret = 0;
-    ssize_t len;
+    int ret = 0;
 
-    if (dev->rx_len == 0) {
-        wait_event_interruptible(dev->r_wait, dev->rf_rxevt);
+    if (applied & A7139_CFG_CODE) {
+        dev->rf_code = old->code;
+        a7139_write_page_a(dev, CODE_PAGEA, dev->rf_code);
     }
 
-    debugf("a7139_read\n");
-
-    down(&dev->sem);
-
-    len = (count > dev->rx_len ? dev->rx_len : count);
+    if (applied & A7139_CFG_TXPOWER) {
+        dev->rf_tx2 = old->tx_power;
+        a7139_write_page_b(dev, TX2_PAGEB, dev->rf_tx2);
+    }
 
-    if (copy_to_user(buf, (void*)dev->rxbuf, len)) {
-        printk(KERN_ERR "%s: copy_to_user error\n", dev->name_alias);
-        ret = -EFAULT;
-    } else {
-        //printk("read %d bytes from %s\n", dev->rx_len, dev->name_alias);
-        ret = len;
+    if (applied & A7139_CFG_RATE) {
+        ret |= a7139_datarate_set(dev, (A7139_RATE)old->datarate);
     }
 
-    dev->rf_rxevt = 0;
-    dev->rx_len = 0;
+    if (applied & A7139_CFG_ID) {
+        ret |= a7139_write_id(dev, (uint8_t *)old->id);
+    }
 
-    up(&dev->sem);
+    /* a failed retune leaves the PLL anywhere */
+    if (applied & A7139_CFG_FREQ) {
+        ret |= a7139_freq_set(dev, old->freq_ch);
+    }
 
-    return ret;
+    if (ret) {
+        printk(KERN_ERR "a7139: config rollback failed, reset the radio\n");
+    }
 }
 
-static ssize_t a7139_write(struct file *filp, const char __user *buf, size_t count, loff_t *ppos)
+/* called in standby, every field is checked before the first write */
+static int a7139_cfg_set(struct rf_dev *dev, const A7139_CFG *cfg)
 {
-    struct rf_dev *dev = filp->private_data;
-    ssize_t len;
-    int err;
+    A7139_CFG old;
+    uint16_t code = dev->rf_code;
+    uint16_t applied = 0;
+    int ret;
 
-    err = wait_event_interruptible_timeout(dev->w_wait, dev->rf_txevt, msecs_to_jiffies(DEV_WRITE_TIMEOUT));
+    if (cfg->version != A7139_CFG_VERSION || cfg->mask & ~A7139_CFG_ALL) {
+        return -EINVAL;
+    }
 
-    debugf("a7139_write\n");
+    if ((cfg->mask & A7139_CFG_FREQ) && cfg->freq_ch >= a7139_ch_count(dev)) {
+        return -EINVAL;
+    }
 
-    down(&dev->sem);
-    if (err == 0)
-    {
-        debugf("a7139_write wait_event_interruptible_timeout\n");
-        dev->rf_txevt = 1;
-        up(&dev->sem);
+    if ((cfg->mask & A7139_CFG_RATE) && cfg->datarate >= A7139_RATE_MAX) {
+        return -EINVAL;
+    }
 
-        return -EAGAIN;
+    if (cfg->mask & A7139_CFG_CODE) {
+        if (cfg->code & ~(A7139_CODE_FEC | A7139_CODE_CRC) ||
+                ((cfg->code & A7139_CODE_CRC) && a7139_frame_ext(dev))) {
+            return -EINVAL;
+        }
+
+        code &= ~(A7139_CODE_FECS | A7139_CODE_CRCS);
+        code |= ((cfg->code & A7139_CODE_FEC) ? A7139_CODE_FECS : 0) |
+                ((cfg->code & A7139_CODE_CRC) ? A7139_CODE_CRCS : 0);
     }
-    else if (dev->rf_currmode != A7139_MODE_RX)
-    {
-        debugf("a7139_write rf_currmode is not A7139_MODE_RX\n");
-        up(&dev->sem);
 
-        return -EAGAIN;
+    /* only the power table bits, the rest of TX2 is not a power setting */
+    if ((cfg->mask & A7139_CFG_TXPOWER) &&
+            (cfg->tx_power & ~A7139_TX2_POWER) != (rf_reg_cfg_page_b[TX2_PAGEB] & ~A7139_TX2_POWER)) {
+        return -EINVAL;
     }
 
-    a7139_mode_switch(dev, A7139_MODE_TXING);
+    memcpy(old.id, dev->rf_id, RF_IDSIZE);
+    old.freq_ch = dev->rf_freq_ch;
+    old.datarate = dev->rf_datarate;
+    old.tx_power = dev->rf_tx2;
+    old.code = dev->rf_code;
+
+    if (cfg->mask & A7139_CFG_ID) {
+        applied |= A7139_CFG_ID;
+        if (a7139_write_id(dev, (uint8_t *)cfg->id)) {
+            ret = -EIO;
+            goto undo;
+        }
+    }
 
-    len = (count > RF_BUFSIZE ? RF_BUFSIZE : count);
+    if (cfg->mask & A7139_CFG_RATE) {
+        applied |= A7139_CFG_RATE;
+        ret = a7139_datarate_set(dev, (A7139_RATE)cfg->datarate);
+        if (ret) {
+            goto undo;
+        }
+    }
 
-    if (copy_from_user(dev->txbuf, buf, len)) {
-        printk(KERN_ERR "%s: copy_from_user error\n", dev->name_alias);
-        up(&dev->sem);
+    if (cfg->mask & A7139_CFG_TXPOWER) {
+        applied |= A7139_CFG_TXPOWER;
+        dev->rf_tx2 = cfg->tx_power;
+        a7139_write_page_b(dev, TX2_PAGEB, dev->rf_tx2);
+    }
 
-        return -EFAULT;
+    if (cfg->mask & A7139_CFG_CODE) {
+        applied |= A7139_CFG_CODE;
+        dev->rf_code = code;
+        a7139_write_page_a(dev, CODE_PAGEA, dev->rf_code);
     }
-    dev->tx_len = len;
 
-    INIT_WORK(&dev->work, a7139_writework_func);
-    queue_work(dev->work_queue, &dev->work);
+    /* last, it may have to calibrate the channel */
+    if (cfg->mask & A7139_CFG_FREQ) {
+        applied |= A7139_CFG_FREQ;
+        ret = a7139_freq_set(dev, cfg->freq_ch);
+        if (ret) {
+            goto undo;
+        }
+    }
 
-    up(&dev->sem);
+    return 0;
 
-    return len;
+undo:
+    a7139_cfg_undo(dev, &old, applied);
+    return ret;
 }
 
-static unsigned int a7139_poll(struct file *filp, struct poll_table_struct *wait)
+/* ioctls that change the radio, everything but the getters and the per file settings */
+static bool a7139_ioc_config(unsigned int cmd)
 {
-    unsigned int mask = 0;
-    struct rf_dev *dev = filp->private_data;
+    /* checked by A7139_IOC_CONFIG itself, mask 0 is a getter */
+    if (cmd == A7139_IOC_SETRXFMT || cmd == A7139_IOC_SETFILTER || cmd == A7139_IOC_CONFIG) {
+        return false;
+    }
 
-    debugf("a7139_poll: rxevt:%d, txevt:%d\n", dev->rf_rxevt, dev->rf_txevt);
+    return (_IOC_DIR(cmd) & _IOC_WRITE) || _IOC_DIR(cmd) == _IOC_NONE;
+}
 
-    down(&dev->sem);
+/*
+ * registers are written in standby, entered once by the first command
+ * needing it. A frame on air is let finish, standby would drop it
+ * without tx_done, so the sem is given up until then.
+ */
+static int a7139_ioc_standby(struct rf_dev *dev, int *standby)
+{
+    long left = msecs_to_jiffies(DEV_WRITE_TIMEOUT);
 
-    poll_wait(filp, &dev->r_wait, wait);
-    poll_wait(filp, &dev->w_wait, wait);
+    if (*standby) {
+        return 0;
+    }
 
-    if (dev->rf_rxevt) {
-        mask |= POLLIN | POLLRDNORM;
+    if (dev->gone) {
+        return -ENODEV;
     }
-    if (dev->rf_txevt && dev->rf_currmode == A7139_MODE_RX) {
-        mask |= POLLOUT | POLLWRNORM;
+
+    while (dev->rf_currmode == A7139_MODE_TX) {
+        up(&dev->sem);
+        left = wait_event_interruptible_timeout(dev->w_wait,
+                ACCESS_ONCE(dev->rf_currmode) != A7139_MODE_TX || dev->gone, left);
+        down(&dev->sem);
+
+        if (dev->gone) {
+            return -ENODEV;
+        }
+        if (left < 0) {
+            return -ERESTARTSYS;
+        }
+        if (!left && dev->rf_currmode == A7139_MODE_TX) {
+            return -EBUSY;
+        }
     }
 
-    up(&dev->sem);
+    a7139_mode_switch(dev, A7139_MODE_STANDBY);
+    usleep_range(1000, 2000);
+    *standby = 1;
 
-    return mask;
+    return 0;
 }
 
 static long a7139_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct rf_dev *dev = filp->private_data;
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
     uint8_t id[RF_IDSIZE];
     uint8_t freq_ch;
     int datarate;
+    uint8_t rx_fmt;
+    A7139_RING_REQ ring_req;
+    A7139_ACK_CFG ack_cfg;
+    A7139_TX_RES tx_res;
+    A7139_WOR_CFG wor_cfg;
+    A7139_WOR_STAT wor_stat;
+    A7139_CH_CFG ch_cfg;
+    uint32_t freq_hz;
+    A7139_LBT_CFG lbt_cfg;
+    A7139_LBT_STAT lbt_stat;
+    A7139_SURVEY *survey;
+    A7139_FILTER *filter;
+    A7139_CFG cfg;
+    unsigned int hdr_readers;
+    int standby = 0;
     int ret = 0;
 
     debugf("a7139_ioctl, cmd=0x%x\n", cmd);
@@ -1582,86 +3782,440 @@ static long a7139_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     ret = 0;
     down(&dev->sem);
 
-    a7139_mode_switch(dev, A7139_MODE_STANDBY);
-    spi_mdelay(1);
+    if (dev->gone) {
+        up(&dev->sem);
+
+        return -ENODEV;
+    }
+
+    if (a7139_ioc_config(cmd) && dev->owner != f) {
+        up(&dev->sem);
+
+        return -EPERM;
+    }
 
+    /* getters and the per file settings leave the radio alone */
     switch (cmd) {
         case A7139_IOC_DUMP:
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
             a7139_reg_dump(dev);
             break;
 
-        case A7139_IOC_RESET:
-            cancel_work_sync(&dev->work);
-            flush_workqueue(dev->work_queue);
-            if (a7139_dev_init(dev)) {
-                printk(KERN_ERR "%s:a7139 dev init error!\n", dev->name_alias);
+        case A7139_IOC_RESET:
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            /* a pending tx_work finds the queue reset, no need to wait for it under sem */
+            if (a7139_dev_init(dev)) {
+                printk(KERN_ERR "%s:a7139 dev init error!\n", dev->name_alias);
+                ret = -EBUSY;
+                goto out;
+            }
+
+            /* -ETIMEDOUT/-EIO of a failed calibration stage, see A7139_IOC_GETCAL */
+            ret = a7139_chip_init(dev);
+            if (ret) {
+                printk(KERN_ERR "%s:a7139 chip init error!\n", dev->name_alias);
+                goto out;
+            }
+            a7139_arssi_update(dev);
+            break;
+
+        case A7139_IOC_SETID:
+            if (copy_from_user(id, (void __user *)arg, RF_IDSIZE)) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            if (a7139_write_id(dev, id)) {
+                ret = -EINVAL;
+                goto out;
+            }
+            break;
+
+        case A7139_IOC_GETID:
+            if (!dev->id_valid) {
+                ret = a7139_ioc_standby(dev, &standby);
+                if (ret) {
+                    goto out;
+                }
+            }
+
+            if (a7139_read_id(dev, id)) {
+                ret = -EBUSY;
+                goto out;
+            }
+
+            if (copy_to_user((void __user *)arg, id, RF_IDSIZE)) {
+                ret = -EFAULT;
+            }
+
+            break;
+
+        case A7139_IOC_SETFREQ:
+            if (get_user(freq_ch, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            ret = a7139_freq_set(dev, freq_ch);
+            if (ret) {
+                goto out;
+            }
+            break;
+
+        case A7139_IOC_GETFREQ:
+            if (put_user(dev->rf_freq_ch, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_SETRATE:
+            if (get_user(datarate, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            ret = a7139_datarate_set(dev, (A7139_RATE)datarate);
+            if (ret) {
+                goto out;
+            }
+            break;
+
+        case A7139_IOC_GETRATE:
+            if (put_user(dev->rf_datarate, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_SETRXFMT:
+            if (get_user(rx_fmt, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            if (rx_fmt >= A7139_RXFMT_MAX) {
+                ret = -EINVAL;
+                goto out;
+            }
+
+            /* frames are kept with their header, only this file changes format */
+            hdr_readers = dev->hdr_readers;
+            if (f->rx_fmt == A7139_RXFMT_HDR) {
+                hdr_readers--;
+            }
+            if (rx_fmt == A7139_RXFMT_HDR) {
+                hdr_readers++;
+            }
+
+            /* ARSSI=1, RSSI is measured during rx for the header, only the first and last reader touch it */
+            if (!hdr_readers != !dev->hdr_readers) {
+                ret = a7139_ioc_standby(dev, &standby);
+                if (ret) {
+                    goto out;
+                }
+            }
+
+            dev->hdr_readers = hdr_readers;
+            f->rx_fmt = rx_fmt;
+            if (standby) {
+                a7139_arssi_update(dev);
+            }
+            break;
+
+        case A7139_IOC_GETRXFMT:
+            if (put_user(f->rx_fmt, (uint8_t __user *)arg)) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_SETRING:
+            if (copy_from_user(&ring_req, (void __user *)arg, sizeof(ring_req))) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            /* the old slots are still mapped by someone */
+            if (atomic_read(&dev->ring_mapped)) {
+                ret = -EBUSY;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            a7139_ring_free(dev);
+            ret = a7139_ring_alloc(dev, &ring_req);
+            a7139_arssi_update(dev);
+            break;
+
+        case A7139_IOC_SETACK:
+            if (copy_from_user(&ack_cfg, (void __user *)arg, sizeof(ack_cfg))) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            ret = a7139_ack_set(dev, &ack_cfg);
+            break;
+
+        case A7139_IOC_GETACK:
+            if (copy_to_user((void __user *)arg, &dev->ack_cfg, sizeof(dev->ack_cfg))) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_GETTXRES:
+            /* one queue for every writer, drained by the owner only */
+            if (dev->owner != f) {
+                ret = -EPERM;
+                goto out;
+            }
+
+            if (!kfifo_get(&dev->tx_res, &tx_res)) {
+                ret = -EAGAIN;
+                goto out;
+            }
+
+            if (copy_to_user((void __user *)arg, &tx_res, sizeof(tx_res))) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_SETWOR:
+            if (copy_from_user(&wor_cfg, (void __user *)arg, sizeof(wor_cfg))) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            /* GIO1 is FPF with the FIFO extension, it can not report wake-ups */
+            if (wor_cfg.mode >= A7139_WOR_MAX || wor_cfg.rx_win > A7139_WOR_RX_WIN_MAX ||
+                    wor_cfg.sleep > A7139_WOR_SLEEP_MAX ||
+                    (wor_cfg.mode != A7139_WOR_OFF && (a7139_frame_ext(dev) || dev->lbt_cfg.enable))) {
+                ret = -EINVAL;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            if (wor_cfg.mode != A7139_WOR_OFF) {
+                ret = a7139_rcosc_cal(dev);
+                if (ret) {
+                    goto out;
+                }
+            }
+
+            /* armed by the switch back to rx */
+            dev->wor_cfg = wor_cfg;
+            break;
+
+        case A7139_IOC_GETWOR:
+            wor_stat.cfg = dev->wor_cfg;
+            wor_stat.duty_ppm = a7139_wor_duty_ppm(&dev->wor_cfg);
+            wor_stat.wakes = dev->wor_wakes;
+            wor_stat.false_wakes = dev->wor_false_wakes;
+
+            if (copy_to_user((void __user *)arg, &wor_stat, sizeof(wor_stat))) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_SETLBT:
+            if (copy_from_user(&lbt_cfg, (void __user *)arg, sizeof(lbt_cfg))) {
+                ret = -EFAULT;
+                goto out;
+            }
+
+            /* the receiver sleeps between WOR windows, RSSI would be stale */
+            if (lbt_cfg.enable && (!lbt_cfg.max_tries ||
+                    !lbt_cfg.slot_ms || lbt_cfg.slot_ms > A7139_LBT_SLOT_MAX_MS ||
+                    !lbt_cfg.max_slots || lbt_cfg.max_slots > A7139_LBT_MAX_SLOTS ||
+                    dev->wor_cfg.mode != A7139_WOR_OFF)) {
+                ret = -EINVAL;
+                goto out;
+            }
+
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            dev->lbt_cfg = lbt_cfg;
+            a7139_arssi_update(dev);
+            break;
+
+        case A7139_IOC_GETLBT:
+            lbt_stat.cfg = dev->lbt_cfg;
+            lbt_stat.deferrals = dev->stats.lbt_deferrals;
+            lbt_stat.abandoned = dev->stats.lbt_abandoned;
+            lbt_stat.rssi = dev->lbt_rssi;
+            memset(lbt_stat.reserved, 0, sizeof(lbt_stat.reserved));
 
-                return -EBUSY;
+            if (copy_to_user((void __user *)arg, &lbt_stat, sizeof(lbt_stat))) {
+                ret = -EFAULT;
             }
+            break;
 
-            if (a7139_chip_init(dev)) {
-                printk(KERN_ERR "%s:a7139 chip init error!\n", dev->name_alias);
+        case A7139_IOC_SURVEY:
+            survey = kmalloc(sizeof(*survey), GFP_KERNEL);
+            if (!survey) {
+                ret = -ENOMEM;
+                goto out;
+            }
 
-                return -ENODEV;
+            if (copy_from_user(survey, (void __user *)arg, sizeof(*survey))) {
+                kfree(survey);
+                ret = -EFAULT;
+                goto out;
             }
-            break;
 
-        case A7139_IOC_SETID:
-            if (copy_from_user(id, (void __user *)arg, RF_IDSIZE)) {
+            ret = a7139_ioc_standby(dev, &standby);
+            if (!ret) {
+                ret = a7139_survey(dev, survey);
+            }
+            if (!ret && copy_to_user((void __user *)arg, survey, sizeof(*survey))) {
                 ret = -EFAULT;
+            }
+            kfree(survey);
+            break;
+
+        case A7139_IOC_SETFILTER:
+            filter = kmalloc(sizeof(*filter), GFP_KERNEL);
+            if (!filter) {
+                ret = -ENOMEM;
                 goto out;
             }
 
-            if (a7139_write_id(dev, id)) {
-                ret = -EINVAL;
+            if (copy_from_user(filter, (void __user *)arg, sizeof(*filter))) {
+                kfree(filter);
+                ret = -EFAULT;
                 goto out;
             }
+
+            ret = a7139_filter_check(filter);
+            if (!ret) {
+                filter->filtered = 0;
+                f->filter = *filter;
+            }
+            kfree(filter);
             break;
 
-        case A7139_IOC_GETID:
-            if (a7139_read_id(dev, id)) {
-                ret = -EBUSY;
+        case A7139_IOC_GETFILTER:
+            if (copy_to_user((void __user *)arg, &f->filter, sizeof(f->filter))) {
+                ret = -EFAULT;
+            }
+            break;
+
+        case A7139_IOC_CONFIG:
+            if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg))) {
+                ret = -EFAULT;
                 goto out;
             }
 
-            if (copy_to_user((void __user *)arg, id, RF_IDSIZE)) {
+            if (cfg.mask) {
+                if (dev->owner != f) {
+                    ret = -EPERM;
+                    goto out;
+                }
+
+                ret = a7139_ioc_standby(dev, &standby);
+                if (ret) {
+                    goto out;
+                }
+            }
+
+            /* the effective config goes back on failure too */
+            ret = a7139_cfg_set(dev, &cfg);
+            a7139_cfg_get(dev, &cfg);
+            if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)) && !ret) {
                 ret = -EFAULT;
             }
+            break;
 
+        case A7139_IOC_GETCAL:
+            if (copy_to_user((void __user *)arg, &dev->cal_stat, sizeof(dev->cal_stat))) {
+                ret = -EFAULT;
+            }
             break;
 
-        case A7139_IOC_SETFREQ:
-            if (get_user(freq_ch, (uint8_t __user *)arg)) {
+        case A7139_IOC_SETCHMODE:
+            if (copy_from_user(&ch_cfg, (void __user *)arg, sizeof(ch_cfg))) {
                 ret = -EFAULT;
                 goto out;
             }
 
-            if (a7139_freq_set(dev, freq_ch)) {
-                ret = -EINVAL;
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            ret = a7139_ch_mode_set(dev, &ch_cfg);
+            if (ret) {
                 goto out;
             }
             break;
 
-        case A7139_IOC_GETFREQ:
-            if (put_user(dev->rf_freq_ch, (uint8_t __user *)arg)) {
+        case A7139_IOC_GETCHMODE:
+            if (copy_to_user((void __user *)arg, &dev->ch_cfg, sizeof(dev->ch_cfg))) {
                 ret = -EFAULT;
             }
             break;
 
-        case A7139_IOC_SETRATE:
-            if (get_user(datarate, (uint8_t __user *)arg)) {
+        case A7139_IOC_SETFREQHZ:
+            if (get_user(freq_hz, (uint32_t __user *)arg)) {
                 ret = -EFAULT;
                 goto out;
             }
 
-            if (a7139_datarate_set(dev, (A7139_RATE)datarate)) {
-                ret = -EINVAL;
+            ret = a7139_ioc_standby(dev, &standby);
+            if (ret) {
+                goto out;
+            }
+
+            memset(&ch_cfg, 0, sizeof(ch_cfg));
+            ch_cfg.mode = A7139_CH_PLAN;
+            ch_cfg.base = 0;
+            ch_cfg.channels = 1;
+            ch_cfg.base_hz = freq_hz;
+
+            ret = a7139_ch_mode_set(dev, &ch_cfg);
+            if (ret) {
                 goto out;
             }
             break;
 
-        case A7139_IOC_GETRATE:
-            if (put_user(dev->rf_datarate, (uint8_t __user *)arg)) {
+        case A7139_IOC_GETFREQHZ:
+            if (put_user(a7139_ch_hz(dev), (uint32_t __user *)arg)) {
                 ret = -EFAULT;
             }
             break;
@@ -1672,80 +4226,197 @@ static long a7139_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     }
 
 out:
-    a7139_mode_switch(dev, A7139_MODE_RX);
+    if (standby) {
+        a7139_mode_switch(dev, A7139_MODE_RX);
+        a7139_tx_kick(dev);
+    }
 
     up(&dev->sem);
 
     return ret;
 }
 
-static int a7139_open(struct inode *inode, struct file *filp)
+/* the radio starts with its first file, config lost with the last one */
+static int a7139_radio_up(struct rf_dev *dev)
 {
-    struct rf_dev *dev;
     int result;
 
-    dev = container_of(inode->i_cdev, struct rf_dev, cdev);
-    filp->private_data = dev;
-
-    /* must use block mode open */
-    if (filp->f_flags & O_NONBLOCK) {
-        return -ENOTBLK;
-    }
-
-    if (dev->opencount) {
-        return -EBUSY;
-    }
-
-    dev->opencount++;
-
     if (a7139_dev_init(dev)) {
         printk(KERN_ERR "%s:a7139 dev init error!\n", dev->name_alias);
-        dev->opencount--;
         return -EBUSY;
     }
 
-    if (a7139_chip_init(dev)) {
+    result = a7139_chip_init(dev);
+    if (result) {
         printk(KERN_ERR "%s:a7139 chip init error!\n", dev->name_alias);
-        dev->opencount--;
-        return -ENODEV;
+        return result;
     }
 
     a7139_mode_switch(dev, A7139_MODE_RX);
 
-    dev->irq = gpio_to_irq(dev->pin.gio1);
+    dev->irq = dev->irq_line;
     if (dev->irq < 0) {
         printk(KERN_ERR "%s: open - can't get irq no, errno:%d\n", dev->name_alias, dev->irq);
-        dev->opencount--;
         return -EINVAL;
     }
 
-    result = request_irq(dev->irq, a7139_interrupt, IRQF_TRIGGER_FALLING | IRQF_DISABLED,
+    /* FIFO drain, crc check and mode switch run in the irq thread */
+    dev->irq_task = NULL;
+    result = request_threaded_irq(dev->irq, a7139_hardirq, a7139_interrupt, IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
             dev->name_alias, (void *)dev);
     if (result) {
         printk(KERN_ERR "%s: open - can't get irq\n", dev->name_alias);
-        dev->opencount--;
         return result;
     }
+    a7139_irq_thread_setup(dev);
+
+    return 0;
+}
+
+static void a7139_radio_down(struct rf_dev *dev)
+{
+    if (dev->irq > 0) {
+        free_irq(dev->irq, (void *)dev);
+        dev->irq = -1;
+    }
+
+    /* frames still queued for tx are dropped, the queue is reset on open */
+    cancel_work_sync(&dev->tx_work);
+    cancel_delayed_work_sync(&dev->lbt_work);
+    dev->lbt_held = 0;
+
+    a7139_mode_switch(dev, A7139_MODE_STANDBY);
+}
+
+/* the last reference, from remove() or the last file open at that time */
+static void a7139_dev_release(struct kref *ref)
+{
+    struct rf_dev *dev = container_of(ref, struct rf_dev, ref);
+
+    kfifo_free(&dev->tx_fifo);
+    kfifo_free(&dev->tx_stamps);
+    kfree(dev);
+}
+
+/* the oldest file left that is open for writing */
+static void a7139_owner_pass(struct rf_dev *dev)
+{
+    struct rf_file *f;
+
+    dev->owner = NULL;
+    list_for_each_entry(f, &dev->files, node) {
+        if (f->mode & FMODE_WRITE) {
+            dev->owner = f;
+            break;
+        }
+    }
+}
+
+static int a7139_open(struct inode *inode, struct file *filp)
+{
+    struct rf_dev *dev;
+    struct rf_file *f;
+    int result;
+
+    dev = container_of(inode->i_cdev, struct rf_dev, cdev);
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f) {
+        return -ENOMEM;
+    }
+    f->dev = dev;
+    f->mode = filp->f_mode;
+    f->rx_fmt = A7139_RXFMT_RAW;
+
+    result = kfifo_alloc(&f->rxq, rx_frames, GFP_KERNEL);
+    if (result) {
+        kfree(f);
+        return result;
+    }
+
+    mutex_lock(&dev->open_lock);
+
+    /* opened through the cdev just before remove() deleted it */
+    if (dev->gone) {
+        mutex_unlock(&dev->open_lock);
+        kfifo_free(&f->rxq);
+        kfree(f);
+        return -ENODEV;
+    }
+
+    if (!dev->opencount) {
+        result = a7139_radio_up(dev);
+        if (result) {
+            mutex_unlock(&dev->open_lock);
+            kfifo_free(&f->rxq);
+            kfree(f);
+            return result;
+        }
+    }
+
+    down(&dev->sem);
+    list_add_tail(&f->node, &dev->files);
+    if (!dev->owner && (f->mode & FMODE_WRITE)) {
+        dev->owner = f;
+    }
+    dev->opencount++;
+    kref_get(&dev->ref);
+    up(&dev->sem);
+
+    mutex_unlock(&dev->open_lock);
 
-    debugf("%s opened.\n", dev->name_alias);
+    filp->private_data = f;
+    debugf("%s opened, %u files.\n", dev->name_alias, dev->opencount);
 
     return 0;
 }
 
 static int a7139_release(struct inode *inode, struct file *filp)
 {
-    struct rf_dev *dev = filp->private_data;
+    struct rf_file *f = filp->private_data;
+    struct rf_dev *dev = f->dev;
+    int standby = 0;
+    int rearm = 0;
 
+    mutex_lock(&dev->open_lock);
+
+    down(&dev->sem);
+    list_del(&f->node);
+    if (f->rx_fmt == A7139_RXFMT_HDR) {
+        dev->hdr_readers--;
+        rearm = 1;
+    }
+    if (dev->owner == f) {
+        /* a mapping holds the file, so the rings are unmapped by now */
+        if (dev->ring) {
+            a7139_ring_free(dev);
+            rearm = 1;
+        }
+        a7139_owner_pass(dev);
+    }
     dev->opencount--;
 
-    if (dev->irq > 0) {
-        free_irq(dev->irq, (void *)dev);
-        dev->irq = -1;
+    /* ARSSI only as long as a remaining file wants it, a busy sender leaves it on */
+    if (dev->opencount && rearm && !a7139_ioc_standby(dev, &standby)) {
+        a7139_arssi_update(dev);
+        a7139_mode_switch(dev, A7139_MODE_RX);
+        a7139_tx_kick(dev);
     }
+    up(&dev->sem);
 
-    a7139_mode_switch(dev, A7139_MODE_STANDBY);
+    /* remove() took the radio down already */
+    if (!dev->opencount && !dev->gone) {
+        a7139_radio_down(dev);
+    }
+
+    mutex_unlock(&dev->open_lock);
+
+    a7139_rxq_flush(f);
+    kfifo_free(&f->rxq);
+    kfree(f);
 
     debugf("%s closed.\n", dev->name_alias);
+    kref_put(&dev->ref, a7139_dev_release);
 
     return 0;
 }
@@ -1757,113 +4428,354 @@ static struct file_operations a7139_fops = {
     .read               = a7139_read,
     .write              = a7139_write,
     .poll               = a7139_poll,
+    .mmap               = a7139_mmap,
     .unlocked_ioctl     = a7139_ioctl,
 };
 
-static int a7139_setup_cdev(struct rf_dev *devs, int dev_nr)
+/*****
+ ** platform device, one per radio
+ *****/
+#ifdef CONFIG_OF
+static struct a7139_platform_data *a7139_of_pdata(struct platform_device *pdev)
 {
-    int devno;
-    int index, result;
-    struct rf_dev *dev;
+    struct device_node *np = pdev->dev.of_node;
+    struct a7139_platform_data *pdata;
+    u32 val;
 
-    devno = MKDEV(a7139_major, 0);
-    if (a7139_major) {
-        result = register_chrdev_region(devno, dev_nr, DEVICE_NAME);
-    } else {
-        result = alloc_chrdev_region(&devno, 0, dev_nr, DEVICE_NAME);
-        a7139_major = MAJOR(devno);
+    pdata = devm_kzalloc(&pdev->dev, sizeof(*pdata), GFP_KERNEL);
+    if (!pdata) {
+        return ERR_PTR(-ENOMEM);
     }
 
-    if (result < 0) {
-        printk(KERN_ERR "alloc chrdev error %d\n", result);
-        goto out2;
+    pdata->spi_bus = -1;
+    if (!of_property_read_u32(np, "spi-bus", &val)) {
+        pdata->spi_bus = val;
     }
-
-    dev_class = class_create(THIS_MODULE, DEVICE_NAME);
-    if (IS_ERR(dev_class)) {
-        printk(KERN_ERR "Error in creating class.\n");
-        result = -EFAULT;
-        goto out;
+    if (!of_property_read_u32(np, "spi-cs", &val)) {
+        pdata->spi_cs = val;
+    }
+    if (!of_property_read_u32(np, "spi-max-frequency", &val)) {
+        pdata->spi_speed = val;
     }
 
-    for (index = 0; index < dev_nr; index++) {
-        dev = &devs[index];
+    /* -EPROBE_DEFER while the gpio controller is not up, passed on as is */
+    pdata->gio1 = of_get_named_gpio(np, "gio1-gpios", 0);
+    if (pdata->gio1 < 0) {
+        return ERR_PTR(pdata->gio1);
+    }
 
-        /* init a7139 pin */
-        if (a7139_pin_init(dev)) {
-            printk(KERN_ERR "Init %s pins error\n", dev->name_alias);
-            continue;
+    pdata->scs = of_get_named_gpio(np, "scs-gpios", 0);
+    pdata->sck = of_get_named_gpio(np, "sck-gpios", 0);
+    pdata->sdio = of_get_named_gpio(np, "sdio-gpios", 0);
+    if (pdata->spi_bus < 0) {
+        if (pdata->scs < 0) {
+            return ERR_PTR(pdata->scs);
         }
-
-        devno = MKDEV(a7139_major, index);
-        cdev_init(&dev->cdev, &a7139_fops);
-        dev->cdev.owner = THIS_MODULE;
-        dev->cdev.ops = &a7139_fops;
-        result = cdev_add(&dev->cdev, devno, 1);
-        if (result) {
-            printk(KERN_ERR "Error %d adding %s\n", result, dev->name_alias);
-            goto out;
+        if (pdata->sck < 0) {
+            return ERR_PTR(pdata->sck);
         }
+        if (pdata->sdio < 0) {
+            return ERR_PTR(pdata->sdio);
+        }
+    }
+
+    return pdata;
+}
 
-        init_waitqueue_head(&dev->r_wait);
-        init_waitqueue_head(&dev->w_wait);
+/* a device tree radio, probed or still deferred, replaces the legacy one */
+static bool a7139_of_present(void)
+{
+    struct device_node *np;
 
-        device_create(dev_class, NULL, devno, NULL, dev->name_alias);
+    np = of_find_compatible_node(NULL, NULL, "amiccom,a7139");
+    if (!np) {
+        return false;
+    }
+    of_node_put(np);
 
-        sema_init(&dev->sem, 1);
+    return true;
+}
 
-        dev->work_queue = create_singlethread_workqueue(dev->name_alias);
-        if (!dev->work_queue)
-        {
-            printk(KERN_ERR "create workqueue fail!\n");
-            goto out;
+static const struct of_device_id a7139_of_match[] = {
+    { .compatible = "amiccom,a7139" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, a7139_of_match);
+#else
+static struct a7139_platform_data *a7139_of_pdata(struct platform_device *pdev)
+{
+    return NULL;
+}
+
+static bool a7139_of_present(void)
+{
+    return false;
+}
+#endif
+
+static int a7139_probe(struct platform_device *pdev)
+{
+    struct a7139_platform_data *pdata = pdev->dev.platform_data;
+    struct rf_dev *dev;
+    struct device *node;
+    dev_t devno;
+    int result;
+
+    if (!pdata && pdev->dev.of_node) {
+        pdata = a7139_of_pdata(pdev);
+        if (IS_ERR(pdata)) {
+            return PTR_ERR(pdata);
         }
     }
+    if (!pdata || !gpio_is_valid(pdata->gio1) ||
+            (pdata->spi_bus < 0 && (!gpio_is_valid(pdata->scs) ||
+            !gpio_is_valid(pdata->sck) || !gpio_is_valid(pdata->sdio)))) {
+        printk(KERN_ERR "%s: no usable pins for the radio\n", dev_name(&pdev->dev));
+        return -EINVAL;
+    }
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev) {
+        return -ENOMEM;
+    }
+
+    dev->index = ida_simple_get(&a7139_ida, 0, A7139_MINORS, GFP_KERNEL);
+    if (dev->index < 0) {
+        result = dev->index;
+        goto err_free;
+    }
+    snprintf(dev->name, sizeof(dev->name), DEVICE_NAME "-%d", dev->index + 1);
+    dev->name_alias = dev->name;
+
+    dev->irq = -1;
+    dev->pin.scs = pdata->scs;
+    dev->pin.sck = pdata->sck;
+    dev->pin.sdio = pdata->sdio;
+    dev->pin.gio1 = pdata->gio1;
+    dev->spi_bus = pdata->spi_bus;
+    dev->spi_cs = pdata->spi_cs;
+    dev->spi_speed = pdata->spi_speed ? pdata->spi_speed : spi_speed;
+    dev->rf_currmode = A7139_MODE_STANDBY;
+    dev->rf_datarate = RF_DEF_RATE;
+    dev->rf_freq_ch = RF_DEF_FREQ_CH;
+    dev->rf_id[0] = RF_DEF_ID_D0;
+    dev->rf_id[1] = RF_DEF_ID_D1;
+
+    /* an interrupt resource overrides the one of the GIO1 gpio */
+    dev->irq_line = platform_get_irq(pdev, 0);
+    if (dev->irq_line < 0) {
+        dev->irq_line = gpio_to_irq(dev->pin.gio1);
+    }
+
+    /* init a7139 pin */
+    result = a7139_pin_init(dev);
+    if (result) {
+        printk(KERN_ERR "Init %s pins error\n", dev->name_alias);
+        goto err_ida;
+    }
+    printk(KERN_INFO "%s: use %s bus, sck half period +%uns\n", dev->name_alias, dev->bus->name, dev->half_ns);
+
+    init_waitqueue_head(&dev->r_wait);
+    init_waitqueue_head(&dev->w_wait);
+    sema_init(&dev->sem, 1);
+    mutex_init(&dev->open_lock);
+    INIT_LIST_HEAD(&dev->files);
+    kref_init(&dev->ref);
+    spin_lock_init(&dev->irq_lock);
+
+    dev->frame_max = clamp_t(unsigned int, frame_max, RF_BUFSIZE, A7139_FRAME_MAX);
+    if (a7139_frame_ext(dev)) {
+        printk(KERN_INFO "%s: FIFO extension, frames up to %u bytes\n", dev->name_alias, dev->frame_max);
+    }
+
+    result = kfifo_alloc(&dev->tx_fifo, tx_frames * (dev->frame_max + 2), GFP_KERNEL);
+    if (result) {
+        printk(KERN_ERR "%s: alloc tx queue fail!\n", dev->name_alias);
+        goto err_pin;
+    }
+
+    result = kfifo_alloc(&dev->tx_stamps, tx_frames * sizeof(s64), GFP_KERNEL);
+    if (result) {
+        printk(KERN_ERR "%s: alloc latency stamps fail!\n", dev->name_alias);
+        goto err_tx;
+    }
+
+    INIT_KFIFO(dev->tx_res);
+
+    INIT_WORK(&dev->tx_work, a7139_writework_func);
+    INIT_DELAYED_WORK(&dev->lbt_work, a7139_lbt_work_func);
+
+    dev->work_queue = create_singlethread_workqueue(dev->name_alias);
+    if (!dev->work_queue) {
+        printk(KERN_ERR "%s: create workqueue fail!\n", dev->name_alias);
+        result = -ENOMEM;
+        goto err_stamps;
+    }
+
+    if (a7139_debugfs) {
+        dev->debugfs = debugfs_create_dir(dev->name_alias, a7139_debugfs);
+        debugfs_create_file("bench", S_IRUSR, dev->debugfs, dev, &a7139_bench_fops);
+        debugfs_create_file("stats", S_IRUGO | S_IWUSR, dev->debugfs, dev, &a7139_stats_fops);
+        debugfs_create_u32("rx_dropped", S_IRUGO, dev->debugfs, &dev->stats.rx_dropped);
+        debugfs_create_u32("tx_acked", S_IRUGO, dev->debugfs, &dev->tx_acked);
+        debugfs_create_u32("tx_noack", S_IRUGO, dev->debugfs, &dev->tx_noack);
+        debugfs_create_u32("wor_wakes", S_IRUGO, dev->debugfs, &dev->wor_wakes);
+        debugfs_create_u32("reg_saved", S_IRUGO, dev->debugfs, &dev->reg_saved);
+    }
+
+    /* live from here on, open() may come at once */
+    devno = MKDEV(MAJOR(a7139_devt), dev->index);
+    cdev_init(&dev->cdev, &a7139_fops);
+    dev->cdev.owner = THIS_MODULE;
+    result = cdev_add(&dev->cdev, devno, 1);
+    if (result) {
+        printk(KERN_ERR "Error %d adding %s\n", result, dev->name_alias);
+        goto err_wq;
+    }
+
+    node = device_create(dev_class, &pdev->dev, devno, NULL, "%s", dev->name_alias);
+    if (IS_ERR(node)) {
+        printk(KERN_ERR "Error creating %s device node\n", dev->name_alias);
+        result = PTR_ERR(node);
+        goto err_cdev;
+    }
+
+    platform_set_drvdata(pdev, dev);
+    atomic_inc(&a7139_probed);
 
     return 0;
 
-out:
-    class_destroy(dev_class);
-out2:
-    unregister_chrdev_region(devno, dev_nr);
+err_cdev:
+    cdev_del(&dev->cdev);
+err_wq:
+    debugfs_remove_recursive(dev->debugfs);
+    destroy_workqueue(dev->work_queue);
+err_stamps:
+    kfifo_free(&dev->tx_stamps);
+err_tx:
+    kfifo_free(&dev->tx_fifo);
+err_pin:
+    a7139_pin_free(dev);
+err_ida:
+    ida_simple_remove(&a7139_ida, dev->index);
+err_free:
+    kfree(dev);
     return result;
 }
 
-static int __init a7139_init(void)
+static int a7139_remove(struct platform_device *pdev)
 {
-    printk(KERN_INFO "%s driver init. Version:%s\n", DEVICE_NAME, VERSION);
+    struct rf_dev *dev = platform_get_drvdata(pdev);
 
-    if (a7139_setup_cdev(devs, ARRAY_SIZE(devs))) {
-        return -EFAULT;
+    device_destroy(dev_class, MKDEV(MAJOR(a7139_devt), dev->index));
+    cdev_del(&dev->cdev);
+
+    /* files still open keep dev, their calls fail with -ENODEV from here on */
+    mutex_lock(&dev->open_lock);
+    down(&dev->sem);
+    dev->gone = 1;
+    up(&dev->sem);
+    if (dev->opencount) {
+        a7139_radio_down(dev);
     }
+    mutex_unlock(&dev->open_lock);
 
-    printk(KERN_INFO "%s driver init successfully.\n", DEVICE_NAME);
+    wake_up_interruptible_all(&dev->r_wait);
+    wake_up_interruptible_all(&dev->w_wait);
+
+    debugfs_remove_recursive(dev->debugfs);
+    destroy_workqueue(dev->work_queue);
+    a7139_pin_free(dev);
+
+    ida_simple_remove(&a7139_ida, dev->index);
+    platform_set_drvdata(pdev, NULL);
+    atomic_dec(&a7139_probed);
+    kref_put(&dev->ref, a7139_dev_release);
 
     return 0;
 }
 
-static void __exit a7139_exit(void)
+static struct platform_driver a7139_driver = {
+    .probe      = a7139_probe,
+    .remove     = a7139_remove,
+    .driver     = {
+        .name   = DEVICE_NAME,
+        .owner  = THIS_MODULE,
+#ifdef CONFIG_OF
+        .of_match_table = a7139_of_match,
+#endif
+    },
+};
+
+static int __init a7139_init(void)
 {
-    int index;
-    struct rf_dev *dev;
+    int result;
 
-    printk(KERN_INFO "%s exit\n", DEVICE_NAME);
+    printk(KERN_INFO "%s driver init. Version:%s\n", DEVICE_NAME, VERSION);
 
-    for (index = 0; index < ARRAY_SIZE(devs); index++) {
-        dev = &devs[index];
-        if(&dev->cdev)
-        {
-            cdev_del(&dev->cdev);
-            device_destroy(dev_class, MKDEV(a7139_major, index));
+    /* read-only parameters, every radio and open file sizes its queues from them */
+    rx_frames = clamp_t(int, rx_frames, 1, RF_RX_FRAMES_MAX);
+    tx_frames = clamp_t(int, tx_frames, 1, RF_TX_FRAMES_MAX);
+
+    result = alloc_chrdev_region(&a7139_devt, 0, A7139_MINORS, DEVICE_NAME);
+    if (result < 0) {
+        printk(KERN_ERR "alloc chrdev error %d\n", result);
+        return result;
+    }
+
+    dev_class = class_create(THIS_MODULE, DEVICE_NAME);
+    if (IS_ERR(dev_class)) {
+        printk(KERN_ERR "Error in creating class.\n");
+        result = PTR_ERR(dev_class);
+        goto err_region;
+    }
+
+    a7139_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+    if (IS_ERR(a7139_debugfs)) {
+        a7139_debugfs = NULL;
+    }
+
+    /* board file and device tree radios are probed from here */
+    result = platform_driver_register(&a7139_driver);
+    if (result) {
+        goto err_class;
+    }
+
+    if (legacy && !atomic_read(&a7139_probed) && !a7139_of_present()) {
+        a7139_legacy_pdata.spi_bus = spi_bus;
+        a7139_legacy_pdata.spi_cs = spi_cs;
+        a7139_legacy = platform_device_register_data(NULL, DEVICE_NAME, -1,
+                &a7139_legacy_pdata, sizeof(a7139_legacy_pdata));
+        if (IS_ERR(a7139_legacy)) {
+            printk(KERN_ERR "%s: can't register the legacy radio\n", DEVICE_NAME);
+            a7139_legacy = NULL;
         }
+    }
+
+    printk(KERN_INFO "%s driver init successfully, %d radio(s).\n", DEVICE_NAME, atomic_read(&a7139_probed));
+
+    return 0;
+
+err_class:
+    debugfs_remove_recursive(a7139_debugfs);
+    class_destroy(dev_class);
+err_region:
+    unregister_chrdev_region(a7139_devt, A7139_MINORS);
+    return result;
+}
 
-        a7139_pin_free(dev);
+static void __exit a7139_exit(void)
+{
+    printk(KERN_INFO "%s exit\n", DEVICE_NAME);
 
-        destroy_workqueue(dev->work_queue);
+    if (a7139_legacy) {
+        platform_device_unregister(a7139_legacy);
     }
+    platform_driver_unregister(&a7139_driver);
 
-    unregister_chrdev_region(MKDEV(a7139_major, 0), ARRAY_SIZE(devs));
+    debugfs_remove_recursive(a7139_debugfs);
     class_destroy(dev_class);
+    unregister_chrdev_region(a7139_devt, A7139_MINORS);
 }
 
 module_init(a7139_init);
@@ -1872,4 +4784,5 @@ module_exit(a7139_exit);
 MODULE_AUTHOR("redfox.qu@qq.com, yaobyron@gmail.com");
 MODULE_DESCRIPTION("a7139 kernel driver for am335x");
 MODULE_LICENSE("GPL");
+MODULE_ALIAS("platform:" DEVICE_NAME);
 
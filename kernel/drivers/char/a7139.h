@@ -18,8 +18,18 @@
 #ifndef __A7139_H__
 #define __A7139_H__
 
+/*
+ * Several files may be open on one radio. Each gets every received frame
+ * in its own queue, passed by its own A7139_IOC_SETFILTER rules and read
+ * in its own A7139_IOC_SETRXFMT format. Any file open for writing may
+ * write(). mmap() and the ioctls that change the radio are for the owner
+ * only, -EPERM for the others: the oldest file open for writing.
+ * With O_NONBLOCK, read() without a frame and
+ * write() without tx queue room fail with -EAGAIN; poll() tells when.
+ * Once the radio is removed, files still open get -ENODEV and POLLHUP.
+ */
 #define A7139_IOC_MAGIC         'A'
-#define A7139_IOC_MAXNR         8
+#define A7139_IOC_MAXNR         27
 
 #define A7139_IOC_DUMP          _IO(A7139_IOC_MAGIC, 1)
 #define A7139_IOC_RESET         _IO(A7139_IOC_MAGIC, 2)
@@ -29,9 +39,29 @@
 #define A7139_IOC_GETID         _IOR(A7139_IOC_MAGIC, 6, uint16_t)
 #define A7139_IOC_SETRATE       _IOW(A7139_IOC_MAGIC, 7, uint8_t)
 #define A7139_IOC_GETRATE       _IOR(A7139_IOC_MAGIC, 8, uint8_t)
+#define A7139_IOC_SETRXFMT      _IOW(A7139_IOC_MAGIC, 9, uint8_t)
+#define A7139_IOC_GETRXFMT      _IOR(A7139_IOC_MAGIC, 10, uint8_t)
+#define A7139_IOC_SETRING       _IOW(A7139_IOC_MAGIC, 11, A7139_RING_REQ)
+#define A7139_IOC_SETACK        _IOW(A7139_IOC_MAGIC, 12, A7139_ACK_CFG)
+#define A7139_IOC_GETACK        _IOR(A7139_IOC_MAGIC, 13, A7139_ACK_CFG)
+#define A7139_IOC_GETTXRES      _IOR(A7139_IOC_MAGIC, 14, A7139_TX_RES)
+#define A7139_IOC_SETWOR        _IOW(A7139_IOC_MAGIC, 15, A7139_WOR_CFG)
+#define A7139_IOC_GETWOR        _IOR(A7139_IOC_MAGIC, 16, A7139_WOR_STAT)
+#define A7139_IOC_GETCAL        _IOR(A7139_IOC_MAGIC, 17, A7139_CAL_STAT)
+#define A7139_IOC_SETCHMODE     _IOW(A7139_IOC_MAGIC, 18, A7139_CH_CFG)
+#define A7139_IOC_GETCHMODE     _IOR(A7139_IOC_MAGIC, 19, A7139_CH_CFG)
+#define A7139_IOC_SETFREQHZ     _IOW(A7139_IOC_MAGIC, 20, uint32_t)
+#define A7139_IOC_GETFREQHZ     _IOR(A7139_IOC_MAGIC, 21, uint32_t)
+#define A7139_IOC_SETLBT        _IOW(A7139_IOC_MAGIC, 22, A7139_LBT_CFG)
+#define A7139_IOC_GETLBT        _IOR(A7139_IOC_MAGIC, 23, A7139_LBT_STAT)
+#define A7139_IOC_SURVEY        _IOWR(A7139_IOC_MAGIC, 24, A7139_SURVEY)
+#define A7139_IOC_SETFILTER     _IOW(A7139_IOC_MAGIC, 25, A7139_FILTER)
+#define A7139_IOC_GETFILTER     _IOR(A7139_IOC_MAGIC, 26, A7139_FILTER)
+#define A7139_IOC_CONFIG        _IOWR(A7139_IOC_MAGIC, 27, A7139_CFG)
 
 #define RF_FREQ_TAB_MAXSIZE     16
 #define RF_IDSIZE               2
+#define A7139_FRAME_MAX         4096        // longest frame, frame_max= above 64 uses FIFO extension
 
 typedef enum a7139_rate {
     A7139_RATE_2K       = 0,    // 00
@@ -39,6 +69,7 @@ typedef enum a7139_rate {
     A7139_RATE_10K,             // 02
     A7139_RATE_25K,             // 03
     A7139_RATE_50K,             // 04
+    A7139_RATE_100K,            // 05, IF 200KHz, Fdev 25KHz
     A7139_RATE_MAX,             // MAX
 } A7139_RATE;
 
@@ -97,10 +128,257 @@ typedef enum {
 } A1739_FREQ;
 #endif
 
+/*
+ * channel selection, A7139_IOC_SETCHMODE. In A7139_CH_OFFSET the PLL
+ * stays on the calibrated base channel and A7139_IOC_SETFREQ takes the
+ * offset channel, base + ch * spacing_hz, tuned through IF2 alone.
+ * In A7139_CH_PLAN it takes a channel of the user plan, base_hz +
+ * ch * spacing_hz, the PLL words computed from the crystal.
+ * A7139_IOC_SETFREQHZ is a one channel plan.
+ */
+typedef enum {
+    A7139_CH_TABLE      = 0,    // SETFREQ takes an A7139_FREQ, PLL reprogrammed
+    A7139_CH_OFFSET,            // SETFREQ takes an offset channel
+    A7139_CH_PLAN,              // SETFREQ takes a plan channel, PLL reprogrammed
+    A7139_CH_MAX,
+} A7139_CH_MODE;
+
+#define A7139_CH_STEP_HZ        12500       // IF2 offset resolution
+#define A7139_CH_SPAN_HZ        2000000     // offsets stay below the next A7139_FREQ
+#define A7139_FREQ_MIN_HZ       470000000   // A7139_CH_PLAN band
+#define A7139_FREQ_MAX_HZ       510000000
+#define A7139_PLAN_MAX_CHANNELS 64
+
+typedef struct {
+    uint8_t mode;               // A7139_CH_MODE
+    uint8_t base;               // A7139_FREQ, tuned on the switch, PLL channel of A7139_CH_OFFSET, below channels for A7139_CH_PLAN
+    uint8_t channels;           // A7139_CH_PLAN: 1..A7139_PLAN_MAX_CHANNELS
+    uint8_t reserved;
+    uint32_t spacing_hz;        // A7139_CH_OFFSET: multiple of A7139_CH_STEP_HZ below A7139_CH_SPAN_HZ
+    uint32_t base_hz;           // A7139_CH_PLAN: channel 0
+} A7139_CH_CFG;
+
+/* read() format, set by A7139_IOC_SETRXFMT */
+typedef enum {
+    A7139_RXFMT_RAW     = 0,    // payload only
+    A7139_RXFMT_HDR,            // A7139_RX_HDR + payload
+    A7139_RXFMT_MAX,
+} A7139_RXFMT;
+
+#define A7139_RX_MODE_CRCF      0x0200      // mode_reg: CRC error
+#define A7139_RX_MODE_FECF      0x0400      // mode_reg: FEC corrected
+
+typedef struct {
+    uint64_t tstamp;            // ktime_get() ns at the rx done interrupt
+    uint16_t len;               // payload bytes following this header
+    uint16_t mode_reg;          // MODE_REG at the interrupt, CRCF/FECF
+    uint8_t rssi;               // ADC_REG RSSI[7:0]
+    uint8_t freq_ch;            // A7139_FREQ channel, offset or plan channel in A7139_CH_OFFSET/PLAN
+    uint8_t datarate;           // A7139_RATE
+    uint8_t reserved;
+} A7139_RX_HDR;
+
+/*
+ * mmap() rings, set up by A7139_IOC_SETRING and mapped at offset 0:
+ * rx_slots RX slots followed by tx_slots TX slots, slot_size bytes each.
+ * Every slot starts with A7139_SLOT, the payload follows it. The status
+ * word passes slot ownership between driver and user, poll() sleeps and
+ * a write() of 0 bytes sends the tx slots filled since the last one.
+ */
+#define A7139_SLOT_KERNEL       0           // rx: free, owned by the driver
+#define A7139_SLOT_USER         1           // rx: frame ready, owned by user
+#define A7139_SLOT_AVAILABLE    0           // tx: free, owned by user
+#define A7139_SLOT_SEND_REQUEST 1           // tx: filled by user, to be sent
+
+#define A7139_RING_MAX_SLOTS    1024
+
+typedef struct {
+    uint32_t slot_size;         // bytes per slot, multiple of 16, > sizeof(A7139_SLOT)
+    uint32_t rx_slots;          // 0 and 0 removes the rings
+    uint32_t tx_slots;
+} A7139_RING_REQ;
+
+typedef struct {
+    uint32_t status;            // A7139_SLOT_*
+    uint32_t reserved;
+    A7139_RX_HDR hdr;           // rx: metadata, tx: user sets hdr.len
+} A7139_SLOT;
+
+/*
+ * Hardware Auto-ACK/Auto-Resend, A7139_IOC_SETACK. Both ends enable
+ * auto_ack, the sender also auto_resend. Not with the FIFO extension.
+ */
+#define A7139_ACK_MAX_RETRIES   15
+
+typedef struct {
+    uint8_t auto_ack;           // 1: ACK valid frames in hardware
+    uint8_t auto_resend;        // 1: wait for the ACK after each frame, resend on timeout
+    uint8_t retries;            // ARC, resends after the first try
+    uint8_t ard;                // ARD, ACK wait window of (ard+1)*250us
+} A7139_ACK_CFG;
+
+/* per frame auto_resend result, A7139_IOC_GETTXRES, poll() POLLPRI, owner only */
+typedef struct {
+    uint32_t seq;               // frames sent since open, from 1, in send order
+    uint32_t acked;             // 1: VPOAK, the peer ACKed before retries ran out
+} A7139_TX_RES;
+
+/* Wake-on-Radio rx, A7139_IOC_SETWOR. Not with the FIFO extension. */
+typedef enum {
+    A7139_WOR_OFF       = 0,    // continuous rx
+    A7139_WOR_PREAMBLE,         // wake on preamble, GIO1=PMDO
+    A7139_WOR_SYNC,             // wake on ID code, GIO1=FSYNC
+    A7139_WOR_CARRIER,          // wake on carrier above RTH, GIO1=CD
+    A7139_WOR_MAX,
+} A7139_WOR;
+
+#define A7139_WOR_RX_WIN_MAX    0x3F
+#define A7139_WOR_SLEEP_MAX     0x3FF
+
+typedef struct {
+    uint8_t mode;               // A7139_WOR
+    uint8_t rx_win;             // WOR_AC[5:0], rx window of (rx_win+1)*244us
+    uint16_t sleep;             // WOR_SL[9:0], sleep of (sleep+1)*7.8ms
+} A7139_WOR_CFG;
+
+typedef struct {
+    A7139_WOR_CFG cfg;
+    uint32_t duty_ppm;          // rx window share of a WOR period, parts per million
+    uint32_t wakes;             // GIO1 wake-ups since open
+    uint32_t false_wakes;       // wake-ups without a valid frame
+} A7139_WOR_STAT;
+
+/*
+ * Listen-before-talk, A7139_IOC_SETLBT. Each frame waits for RSSI at or
+ * below rssi_thresh, backing off a random 1..window slots while busy.
+ * The window starts at 2 slots and doubles per busy sample up to
+ * max_slots. Not with Wake-on-Radio.
+ */
+#define A7139_LBT_SLOT_MAX_MS   1000
+#define A7139_LBT_MAX_SLOTS     1024
+
+typedef struct {
+    uint8_t enable;
+    uint8_t rssi_thresh;        // ADC_REG RSSI[7:0], busy above it
+    uint8_t max_tries;          // busy samples before the frame is dropped, >= 1
+    uint8_t reserved;
+    uint16_t slot_ms;           // backoff unit, 1..A7139_LBT_SLOT_MAX_MS
+    uint16_t max_slots;         // backoff window cap, 1..A7139_LBT_MAX_SLOTS
+} A7139_LBT_CFG;
+
+typedef struct {
+    A7139_LBT_CFG cfg;
+    uint32_t deferrals;         // busy samples that delayed a frame, since open
+    uint32_t abandoned;         // frames dropped after max_tries busy samples
+    uint8_t rssi;               // last sample
+    uint8_t reserved[3];
+} A7139_LBT_STAT;
+
+/*
+ * Spectrum survey, A7139_IOC_SURVEY. Channels first..first+count-1 of the
+ * current channel mode are each listened to for dwell_ms with ARSSI on.
+ * count comes back as the number of channels surveyed, short when the
+ * mode has fewer channels, a signal interrupted the survey or the call
+ * would listen longer than A7139_SURVEY_TOTAL_MAX_MS; the radio is out
+ * of rx meanwhile, continue from first+count. The radio returns to its
+ * channel afterwards.
+ */
+#define A7139_SURVEY_MAX_CHANNELS   64
+#define A7139_SURVEY_DWELL_MAX_MS   200
+#define A7139_SURVEY_TOTAL_MAX_MS   1000
+
+typedef struct {
+    uint8_t min;                // ADC_REG RSSI[7:0]
+    uint8_t avg;
+    uint8_t max;
+    uint8_t reserved;
+} A7139_SURVEY_CH;
+
+typedef struct {
+    uint16_t dwell_ms;          // 1..A7139_SURVEY_DWELL_MAX_MS
+    uint8_t first;              // first channel, A7139_FREQ, offset or plan channel
+    uint8_t count;              // in: 1..A7139_SURVEY_MAX_CHANNELS, out: surveyed
+    A7139_SURVEY_CH ch[A7139_SURVEY_MAX_CHANNELS];
+} A7139_SURVEY;
+
+/*
+ * Receive filter of one file, A7139_IOC_SETFILTER. A frame is queued when
+ * any rule matches: (payload[offset + i] & mask[i]) == value[i] for each
+ * i with a non-zero mask byte, all inside the frame. The others are
+ * dropped by the irq thread and counted in filtered. No rules pass all.
+ * For an address set, one rule per address on RSWP433 dest_addr.
+ */
+#define A7139_FILTER_MAX_RULES  8
+#define A7139_FILTER_BYTES      4
+
+typedef struct {
+    uint8_t offset;             // of mask[0]/value[0] in the payload
+    uint8_t reserved[3];
+    uint8_t mask[A7139_FILTER_BYTES];
+    uint8_t value[A7139_FILTER_BYTES];
+} A7139_FILTER_RULE;
+
+typedef struct {
+    uint8_t count;              // rules in use, 0..A7139_FILTER_MAX_RULES
+    uint8_t reserved[3];
+    uint32_t filtered;          // GETFILTER: frames dropped since SETFILTER
+    A7139_FILTER_RULE rule[A7139_FILTER_MAX_RULES];
+} A7139_FILTER;
+
+/*
+ * Batch configuration, A7139_IOC_CONFIG. The fields in mask are checked
+ * together and then applied in one standby window, a write that fails
+ * puts the fields already applied back; every field comes back with the
+ * effective value, mask 0 only reads them and is allowed to any file
+ * without leaving rx. Until reset or the last close, like the single
+ * ioctls.
+ */
+#define A7139_CFG_VERSION       1
+
+#define A7139_CFG_ID            0x0001
+#define A7139_CFG_FREQ          0x0002      // channel of the current channel mode
+#define A7139_CFG_RATE          0x0004
+#define A7139_CFG_TXPOWER       0x0008
+#define A7139_CFG_CODE          0x0010
+#define A7139_CFG_ALL           0x001F
+
+#define A7139_CODE_FEC          0x01        // FEC (7,4) hamming
+#define A7139_CODE_CRC          0x02        // hardware CRC, not with the FIFO extension
+
+#define A7139_TX2_POWER         0x007F      // TBG/TDC/PAC, the other TX2 bits stay as read by GETCONFIG
+
+typedef struct {
+    uint16_t version;           // A7139_CFG_VERSION
+    uint16_t mask;              // A7139_CFG_* to apply
+    uint8_t id[RF_IDSIZE];
+    uint8_t freq_ch;
+    uint8_t datarate;           // A7139_RATE
+    uint16_t tx_power;          // TX2 page B word, A7139_TX2_POWER bits from the datasheet TX power table
+    uint8_t code;               // A7139_CODE_*
+    uint8_t reserved[5];
+} A7139_CFG;
+
+/* calibration stages, timed by A7139_IOC_GETCAL */
+typedef enum {
+    A7139_CAL_IF        = 0,    // IF filter and VCO current
+    A7139_CAL_RSSI,             // RSSI
+    A7139_CAL_VCO,              // VCO band
+    A7139_CAL_RCOSC,            // WOR RC oscillator
+    A7139_CAL_STAGES,
+} A7139_CAL_STAGE;
+
+typedef struct {
+    uint32_t stage_us[A7139_CAL_STAGES];    // last run of each stage
+    uint32_t init_us;           // last chip init on open or reset, calibration included
+    int32_t err;                // 0, -ETIMEDOUT: chip never finished, -EIO: fail flag set
+    uint8_t failed_stage;       // A7139_CAL_STAGE of err
+    uint8_t reserved[3];
+} A7139_CAL_STAT;
+
 #define RF_DEF_ID_D0            0xAA
 #define RF_DEF_ID_D1            0x01
 #define RF_DEF_FREQ_CH          A7139_FREQ_470M
-#define RF_DEF_RATE             A7139_RATE_2K
+#define RF_DEF_RATE             A7139_RATE_10K
 
 #endif
 
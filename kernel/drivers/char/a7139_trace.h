@@ -0,0 +1,121 @@
+/*
+ * a7139_trace.h  tracepoints of the a7139 packet lifecycle
+ *
+ * Enable with: echo 1 > /sys/kernel/debug/tracing/events/a7139/enable
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM a7139
+
+#if !defined(__A7139_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __A7139_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(a7139_irq,
+
+    TP_PROTO(const char *name, int mode, uint8_t ch),
+
+    TP_ARGS(name, mode, ch),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(int, mode)
+        __field(uint8_t, ch)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->mode = mode;
+        __entry->ch = ch;
+    ),
+
+    TP_printk("%s mode=%d ch=%u", __get_str(name), __entry->mode, __entry->ch)
+);
+
+TRACE_EVENT(a7139_rx_crc_fail,
+
+    TP_PROTO(const char *name, uint16_t status, uint8_t ch),
+
+    TP_ARGS(name, status, ch),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(uint16_t, status)
+        __field(uint8_t, ch)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->status = status;
+        __entry->ch = ch;
+    ),
+
+    TP_printk("%s mode_reg=0x%04x ch=%u", __get_str(name), __entry->status, __entry->ch)
+);
+
+/* one frame at a point of its way between the radio and user space */
+DECLARE_EVENT_CLASS(a7139_frame,
+
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+
+    TP_ARGS(name, len, ch),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(unsigned int, len)
+        __field(uint8_t, ch)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->len = len;
+        __entry->ch = ch;
+    ),
+
+    TP_printk("%s len=%u ch=%u", __get_str(name), __entry->len, __entry->ch)
+);
+
+/* len: bytes expected, 0 until the frame length is known */
+DEFINE_EVENT(a7139_frame, a7139_rx_drain_start,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_rx_drain_end,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_rx_wake,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_read,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_write,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_tx_strobe,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+DEFINE_EVENT(a7139_frame, a7139_tx_done,
+    TP_PROTO(const char *name, unsigned int len, uint8_t ch),
+    TP_ARGS(name, len, ch)
+);
+
+#endif /* __A7139_TRACE_H__ */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE a7139_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,23 @@
+/*
+ * a7139.h  platform data of the AMICCOM A7139 sub-1GHz radio driver
+ *
+ * One platform device "a7139" per radio, /dev/a7139-N is created for
+ * each. Device tree nodes use compatible = "amiccom,a7139" with
+ * scs-gpios, sck-gpios, sdio-gpios, gio1-gpios and optionally
+ * spi-bus, spi-cs, spi-max-frequency.
+ */
+#ifndef __LINUX_PLATFORM_DATA_A7139_H__
+#define __LINUX_PLATFORM_DATA_A7139_H__
+
+struct a7139_platform_data {
+    int scs;                    /* gpio numbers, scs/sck/sdio unused on McSPI */
+    int sck;
+    int sdio;
+    int gio1;                   /* rx/tx done interrupt */
+
+    int spi_bus;                /* McSPI bus in 3-wire mode, -1 for gpio bit-bang */
+    int spi_cs;
+    int spi_speed;              /* SCK Hz, 0 for the driver default */
+};
+
+#endif
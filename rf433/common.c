@@ -38,6 +38,7 @@ struct collate_st avail_rate_col[] = {
     { "10k",    A7139_RATE_10K  },
     { "25k",    A7139_RATE_25K  },
     { "50k",    A7139_RATE_50K  },
+    { "100k",   A7139_RATE_100K },
 };
 
 struct collate_st avail_wfreq_col[] = {
@@ -51,6 +51,7 @@ char *a7139_rate_str[] = {
     "A7139_RATE_10K",
     "A7139_RATE_25K",
     "A7139_RATE_50K",
+    "A7139_RATE_100K",
 };
 
 char *se433_type_str[] = {
@@ -243,12 +244,22 @@ int set_socket_opt(int fd, uint16_t lport)
 int set_rf433_opt(int fd, uint16_t netid, uint8_t rate)
 {
     A7139_FREQ wfreq;
+    A7139_CFG cfg;
 
     wfreq = RF433_WFREQ(netid);
 
-    rf433_set_netid(fd, netid);
-    rf433_set_wfreq(fd, wfreq);
-    rf433_set_rate(fd, rate);
+    /* one radio standby for all of them */
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.version = A7139_CFG_VERSION;
+    cfg.mask = A7139_CFG_ID | A7139_CFG_FREQ | A7139_CFG_RATE;
+    memcpy(cfg.id, &netid, sizeof(cfg.id));
+    cfg.freq_ch = wfreq;
+    cfg.datarate = rate;
+
+    if (ioctl(fd, A7139_IOC_CONFIG, &cfg) < 0) {
+        app_log_printf(LOG_ERR, "ioctl(A7139_IOC_CONFIG) error: %s", strerror(errno));
+        return -1;
+    }
 
     TRACE("%-20s: 0x%x", "rf433opt.netid", netid);
     TRACE("%-20s: 0x%x(%s)", "rf433opt.wfreq", wfreq, rf433_get_freq_str(wfreq));
@@ -509,6 +520,30 @@ int rf433_get_rate(int fd, uint8_t *rate)
     return ioctl(fd, A7139_IOC_GETRATE, rate);
 }
 
+/*****************************************************************************
+* Function Name  : rf433_set_addr_filter
+* Description    : let the driver drop rswp433 packets not for addr or broadcast
+* Input          : int, uint32_t
+* Output         : None
+* Return         : int(0:ok, -1:error)
+*****************************************************************************/
+int rf433_set_addr_filter(int fd, uint32_t addr)
+{
+    A7139_FILTER filter;
+    uint32_t addrs[2] = { addr, RF433_BROADCAST };
+    int i;
+
+    memset(&filter, 0, sizeof(filter));
+    filter.count = 2;
+    for (i = 0; i < filter.count; i++) {
+        filter.rule[i].offset = offsetof(rswp433_pkg, u.content.dest_addr);
+        memset(filter.rule[i].mask, 0xff, sizeof(filter.rule[i].mask));
+        memcpy(filter.rule[i].value, &addrs[i], sizeof(filter.rule[i].value));
+    }
+
+    return ioctl(fd, A7139_IOC_SETFILTER, &filter);
+}
+
 /*****************************************************************************
 * Function Name  : rswp433_pkg_new
 * Description    : new and return a rswp433 packet
@@ -106,6 +106,7 @@ int rf433_set_wfreq(int fd, uint8_t wfreq);
 int rf433_get_wfreq(int fd, uint8_t *wfreq);
 int rf433_set_rate(int fd, uint8_t rate);
 int rf433_get_rate(int fd, uint8_t *rate);
+int rf433_set_addr_filter(int fd, uint32_t addr);
 
 se433_list *se433_find(se433_head *head, uint32_t se433_addr);
 se433_list *se433_find_earliest(se433_head *head);
@@ -643,6 +643,11 @@ void *thread_job_rf433(void *arg)
         }
         set_rf433_opt(rf433x->rf433_fd, rf433x->rf433.net_id, rf433x->rf433.rate);
 
+        /* only wake up for packets to local_addr or broadcast */
+        if (rf433_set_addr_filter(rf433x->rf433_fd, rf433x->rf433.local_addr) < 0) {
+            app_log_printf(LOG_WARNING, "rf433_set_addr_filter error: %s", strerror(errno));
+        }
+
         rf433x->sock_fd = open_socket();
         if (rf433x->sock_fd == -1) {
             app_log_printf(LOG_ERR, "open_socket error");